@@ -0,0 +1,89 @@
+/*
+* Binary access log format, written by HttpFileServer with --binary-log, read by tools/AccessLogDecoder.
+*
+* a log is a series of segment files named access-<sequence>.hfslog. a segment starts with BINLOG_MAGIC and the
+* time the segment was opened (us since epoch, 8 bytes little endian), followed by entries, each one starts with
+* its kind:
+*   BINLOG_ENTRY_STRING: id, length, bytes. a method or a path, interned per segment, ids count from 0,
+*                        so a path is written once per segment, and the records refer to it by id.
+*   BINLOG_ENTRY_RECORD: time (zigzag delta from the previous record, us), duration (us), body bytes, status,
+*                        method id, path id, cpu time (us), minor faults, major faults, voluntary context
+*                        switches, tcp rtt (us), cwnd (bytes), retransmits, delivery rate (bytes/s), busy time (us),
+*                        receive window limited time (us), client family (BINLOG_CLIENT_*), then 4 or 16 address bytes.
+*   BINLOG_ENTRY_END:    the rest of the segment is unused, segments are preallocated with zeros.
+* all the integers in the entries are LEB128 varints.
+*/
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+constexpr std::array<char, 8> BINLOG_MAGIC{ 'H', 'F', 'S', 'L', 'O', 'G', '0', '3' };
+constexpr size_t BINLOG_HEADER_LEN = BINLOG_MAGIC.size() + 8;
+constexpr size_t BINLOG_VARINT_MAX_LEN = 10;
+
+enum : uint8_t {
+    BINLOG_ENTRY_END = 0,
+    BINLOG_ENTRY_STRING = 1,
+    BINLOG_ENTRY_RECORD = 2
+};
+
+enum : uint8_t {
+    BINLOG_CLIENT_NONE = 0,
+    BINLOG_CLIENT_IPV4 = 4,
+    BINLOG_CLIENT_IPV6 = 6
+};
+
+// writes <value> at <out>, which has room for BINLOG_VARINT_MAX_LEN bytes, returns the bytes written.
+inline size_t binlog_put_varint(uint8_t* out, uint64_t value) {
+    size_t n = 0;
+
+    while (value >= 0x80) {
+        out[n++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+
+    return n;
+}
+
+// reads a varint from [pos, end), returns false if it is truncated or too long.
+inline bool binlog_get_varint(const uint8_t*& pos, const uint8_t* end, uint64_t& value) {
+    value = 0;
+
+    for (unsigned shift = 0; pos < end && shift < 64; shift += 7) {
+        auto byte = *pos++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+inline uint64_t binlog_zigzag_encode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t binlog_zigzag_decode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline void binlog_put_u64le(uint8_t* out, uint64_t value) {
+    for (size_t i = 0; i < 8; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+inline uint64_t binlog_get_u64le(const uint8_t* in) {
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < 8; ++i) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+
+    return value;
+}
@@ -1,5 +1,5 @@
 /*
-* Http file server written in C++20, only supports windows platform.
+* Http file server written in C++20, written for windows platform, also builds on POSIX systems.
 */
 #define WIN32_LEAN_AND_MEAN
 
@@ -16,57 +16,250 @@
 #include <thread>
 #include <queue>
 #include <map>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <charconv>
+#include <string_view>
+#include <span>
 #include <functional>
 #include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include <condition_variable>
+#include <atomic>
+#include <chrono>
 #include <filesystem>   
 #include <source_location>
 #include <cstdint>
 #include <cctype>
+#include <cstring>
+#include <bit>
+#include <system_error>
+#include <utility>
 
+#ifdef _WIN32
 #include <Windows.h>
 #include <WinSock2.h>
 #include <ws2tcpip.h>
+#include <mstcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <linux/tcp.h>   // glibc's netinet/tcp.h lacks the newer tcp_info fields.
+#endif
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <csignal>
+#include <cerrno>
+#endif
+
+#include "BinaryAccessLog.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define HFS_ESCAPE_SSE2
+#endif
+
+/*
+    USDT probes of provider "hfs", for perf, bpftrace or systemtap, like:
+        bpftrace -e 'usdt:./HttpFileServer:hfs:request_parsed { printf("%s\n", str(arg2)); }'
+    a probe is a single nop until a tracer attaches to it, its arguments are kept cheap, since they are still
+    computed. without sys/sdt.h (windows, or systemtap-sdt-dev not installed), or with HFS_NO_USDT defined,
+    the probes compile to nothing.
+*/
+#if !defined(HFS_NO_USDT) && !defined(_WIN32) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HFS_PROBE1(name, a) DTRACE_PROBE1(hfs, name, a)
+#define HFS_PROBE2(name, a, b) DTRACE_PROBE2(hfs, name, a, b)
+#define HFS_PROBE3(name, a, b, c) DTRACE_PROBE3(hfs, name, a, b, c)
+#else
+#define HFS_PROBE1(name, a) ((void)0)
+#define HFS_PROBE2(name, a, b) ((void)0)
+#define HFS_PROBE3(name, a, b, c) ((void)0)
+#endif
 
 using namespace std::string_literals;
 namespace fs = std::filesystem;
 
-static std::string build_response_with_http_code(uint16_t code, const std::string& msg){
-    std::string ret;
-    std::string html = "<html><h1>"s + msg + "</h1></html>"s;
+#ifndef _WIN32
+/*
+    the few socket names that differ from winsock, so the code below is the same on both platforms.
+*/
+using SOCKET = int;
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr int SD_SEND = SHUT_WR;
+
+static int closesocket(SOCKET sock) {
+    return close(sock);
+}
+#endif
+
+/*
+    compile-time built pieces of the response header.
+    a HeaderTemplate holds the characters without the tail '\0', so the pieces could be joined with operator+,
+    and the fixed parts of every response shape are ready before the program runs.
+*/
+template <size_t N>
+struct HeaderTemplate {
+    std::array<char, N> chars{};
+
+    consteval HeaderTemplate() = default;
+
+    consteval HeaderTemplate(const char (&str)[N + 1]) {
+        std::copy_n(str, N, chars.begin());
+    }
+
+    constexpr std::string_view view() const noexcept {
+        return { chars.data(), N };
+    }
+};
+
+template <size_t N>
+HeaderTemplate(const char (&)[N]) -> HeaderTemplate<N - 1>;
+
+template <size_t L, size_t R>
+consteval HeaderTemplate<L + R> operator+(const HeaderTemplate<L>& left, const HeaderTemplate<R>& right) {
+    HeaderTemplate<L + R> result;
+    std::copy(right.chars.begin(), right.chars.end(), std::copy(left.chars.begin(), left.chars.end(), result.chars.begin()));
+    return result;
+}
+
+consteval size_t count_digits(uintmax_t value) {
+    size_t n = 1;
+    while (value >= 10) {
+        value /= 10;
+        ++n;
+    }
+    return n;
+}
+
+template <uintmax_t Value>
+consteval auto header_number() {
+    HeaderTemplate<count_digits(Value)> result;
+    auto v = Value;
+    for (auto i = result.chars.size(); i > 0; --i) {
+        result.chars[i - 1] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    }
+    return result;
+}
+
+constexpr auto HTTP_HEADER_COMMON = HeaderTemplate{ "Server: Miku Server\r\n" } + HeaderTemplate{ "Connection: close\r\n" };
+constexpr auto HTTP_HEADER_200_OK = HeaderTemplate{ "HTTP/1.1 200 OK\r\n" } + HTTP_HEADER_COMMON;
 
-    ret += "HTTP/1.1 "s + std::to_string(code) + " "s + msg + "\r\n";
-    ret += "Content-Type: text/html\r\n";
-    ret += "Content-Length: " + std::to_string(html.size()) + "\r\n\r\n";
-    ret += html;
+template <HeaderTemplate Type>
+constexpr auto HTTP_CONTENT_TYPE = HeaderTemplate{ "Content-Type: " } + Type + HeaderTemplate{ "\r\n" };
+
+/*
+    a status response is known at compile time, including the Content-Length,
+    only the Date line has to be put between <head> and the empty line when sending it.
+*/
+template <size_t H, size_t B>
+struct StatusResponse {
+    uint16_t code;
+    HeaderTemplate<H> head;
+    HeaderTemplate<B> body;
+};
 
-    return ret;
+template <uint16_t Code, HeaderTemplate Msg>
+consteval auto build_response_with_http_code() {
+    constexpr auto html = HeaderTemplate{ "<html><h1>" } + Msg + HeaderTemplate{ "</h1></html>" };
+
+    return StatusResponse{
+        Code,
+        HeaderTemplate{ "HTTP/1.1 " } + header_number<Code>() + HeaderTemplate{ " " } + Msg + HeaderTemplate{ "\r\n" }
+            + HTTP_HEADER_COMMON
+            + HTTP_CONTENT_TYPE<"text/html">
+            + HeaderTemplate{ "Content-Length: " } + header_number<html.chars.size()>() + HeaderTemplate{ "\r\n" },
+        html
+    };
 }
 
-static const std::string HTTP_200_OK = build_response_with_http_code(200, "OK");
-static const std::string HTTP_404_NOT_FOUND = build_response_with_http_code(404, "Not Found");
-static const std::string HTTP_405_METHOD_NOT_ALLOWED = build_response_with_http_code(405, "Method Not Allowd");
-static const std::string HTTP_414_URI_TOO_LONG = build_response_with_http_code(414, "Uri Too Long");
-static const std::string HTTP_500_INTERNAL_SERVER_ERROR = build_response_with_http_code(500, "Internal Server Error");
+constexpr auto HTTP_200_OK = build_response_with_http_code<200, "OK">();
+constexpr auto HTTP_404_NOT_FOUND = build_response_with_http_code<404, "Not Found">();
+constexpr auto HTTP_405_METHOD_NOT_ALLOWED = build_response_with_http_code<405, "Method Not Allowd">();
+constexpr auto HTTP_414_URI_TOO_LONG = build_response_with_http_code<414, "Uri Too Long">();
+constexpr auto HTTP_500_INTERNAL_SERVER_ERROR = build_response_with_http_code<500, "Internal Server Error">();
 
 // constants.
 constexpr uint32_t HTTP_RECV_BUFFER_LEN = 8192;
 constexpr uint32_t HTTP_RECV_TIMEOUT_SEC = 5;
 constexpr uint32_t HTTP_URI_MAX_LEN = 1024;
+constexpr uint32_t HTTP_HEADER_BUFFER_LEN = 512;
+constexpr uint32_t HTTP_DIR_CACHE_CAPACITY = 64;
+constexpr uint32_t HTTP_DIR_CACHE_MAX_AGE_SEC = 2;
+constexpr uint32_t HTTP_LOG_PATH_LEN = 256;
+constexpr uint32_t HTTP_LOG_RING_LEN = 1024;
+constexpr uint32_t HTTP_LOG_SAMPLE_UNDER_LOAD = 8;   // 1 keeps every record until the ring is full.
+constexpr uint32_t HTTP_LOG_FLUSH_INTERVAL_MS = 50;
+constexpr uint32_t HTTP_BINLOG_SEGMENT_LEN = 64 * 1024 * 1024;
+constexpr uint32_t HTTP_BINLOG_KEEP_SEGMENTS = 16;
+constexpr uint32_t HTTP_BINLOG_STRINGS_MAX = 65536;   // interned strings per segment.
+constexpr std::string_view HTTP_METRICS_URI = "/__metrics";
+constexpr uint64_t HTTP_METRICS_BUCKET_MAX_US = uint64_t{ 1 } << 28;   // the largest finite le of the histograms, about 4.5 minutes.
+constexpr std::string_view HTTP_TRACE_URI = "/__trace";   // the dump, a POST to "/on" or "/off" switches tracing.
+constexpr uint32_t HTTP_TRACE_RING_LEN = 4096;   // records per thread.
+constexpr uint32_t HTTP_PREFIX_TABLE_LEN = 128;   // path prefixes with their own resource counters, per thread.
+constexpr std::string_view HTTP_TOP_URI = "/__top";
+constexpr std::string_view HTTP_CONNECTIONS_URI = "/__connections";
+constexpr uint32_t HTTP_HEAVY_HITTERS = 32;   // keys tracked per thread, for each of paths, directories and clients.
+constexpr uint32_t HTTP_HEAVY_WINDOW_SEC = 10;   // the counts decay by half every window.
+constexpr uint32_t HTTP_TOP_SHOWN = 20;
+constexpr uint32_t HTTP_SLOW_REQUEST_MS = 200;   // from accept to the end of the response.
+constexpr uint32_t HTTP_SEND_CHUNK_LEN = 256 * 1024;   // a blocking send() returns once all its data is queued.
+constexpr uint32_t HTTP_TCP_SAMPLE_MS = 1000;   // TCP_INFO is also sampled this often while a response is sent.
+
+static const std::map<std::string, std::string_view> HTTP_MIME_TABLE{   // extension -> the whole Content-Type line.
+    {".css" , HTTP_CONTENT_TYPE<"text/css">.view()},
+    {".gif" , HTTP_CONTENT_TYPE<"image/gif">.view()},
+    {".htm" , HTTP_CONTENT_TYPE<"text/html">.view()},
+    {".html", HTTP_CONTENT_TYPE<"text/html">.view()},
+    {".jpeg", HTTP_CONTENT_TYPE<"image/jpeg">.view()},
+    {".jpg" , HTTP_CONTENT_TYPE<"image/jpeg">.view()},
+    {".ico" , HTTP_CONTENT_TYPE<"image/x-icon">.view()},
+    {".js"  , HTTP_CONTENT_TYPE<"application/javascript">.view()},
+    {".mp4" , HTTP_CONTENT_TYPE<"video/mp4">.view()},
+    {".png" , HTTP_CONTENT_TYPE<"image/png">.view()},
+    {".svg" , HTTP_CONTENT_TYPE<"image/svg+xml">.view()},
+    {".xml" , HTTP_CONTENT_TYPE<"text/xml">.view()}
+};
+
+/*
+    response header builder.
+    the fixed parts come from the compile-time templates, only the dynamic fields (Content-Length, ETag)
+    are formatted here with std::to_chars, and the Date line is copied from HttpDateCache, into a stack buffer, so producing a header never touches the heap.
+*/
+class ResponseHeader {
+    std::array<char, HTTP_HEADER_BUFFER_LEN> buffer;
+    size_t len = 0;
+public:
+    ResponseHeader& append(std::string_view str) noexcept {
+        // the templates and the fields are far shorter than the buffer, cut it anyway rather than overflow.
+        auto n = std::min(str.size(), buffer.size() - len);
+        std::copy_n(str.data(), n, buffer.data() + len);
+        len += n;
+        return *this;
+    }
+
+    ResponseHeader& append_number(uintmax_t value, int base = 10) noexcept {
+        auto [ptr, ec] = std::to_chars(buffer.data() + len, buffer.data() + buffer.size(), value, base);
+        if (ec == std::errc{}) {
+            len = ptr - buffer.data();
+        }
+        return *this;
+    }
 
-static std::map<std::string, std::string> HTTP_MIME_TABLE{
-    {".css" , "text/css"},
-    {".gif" , "image/gif"},
-    {".htm" , "text/html"},
-    {".html", "text/html"},
-    {".jpeg", "image/jpeg"},
-    {".jpg" , "image/jpeg"},
-    {".ico" , "image/x-icon"},
-    {".js"  , "application/javascript"},
-    {".mp4" , "video/mp4"},
-    {".png" , "image/png"},
-    {".svg" , "image/svg+xml"},
-    {".xml" , "text/xml"}
+    std::string_view view() const noexcept {
+        return { buffer.data(), len };
+    }
 };
 
 /*
@@ -75,7 +268,11 @@ static std::map<std::string, std::string> HTTP_MIME_TABLE{
 	http://blog.think-async.com/2010/04/system-error-support-in-c0x-part-5.html
 */
 static std::error_code get_last_sys_ec(){
+#ifdef _WIN32
     return std::error_code(GetLastError(), std::system_category());
+#else
+    return std::error_code(errno, std::system_category());
+#endif
 }
 
 static void print_last_sys_error(const std::string& msg, const std::source_location& slc = std::source_location::current()){
@@ -83,214 +280,3147 @@ static void print_last_sys_error(const std::string& msg, const std::source_locat
     std::osyncstream(std::cerr) << std::format("{}, {}({}): {}, {}\n", slc.file_name(), slc.function_name(), slc.line(), msg, ec.message());
 }
 
-static void print_user_error(const std::string& msg, const std::source_location& slc = std::source_location::current()){
-    std::osyncstream(std::cerr) << std::format("{}, {}({}): {}\n", slc.file_name(), slc.function_name(), slc.line(), msg);
-}
+static void print_user_error(const std::string& msg, const std::source_location& slc = std::source_location::current()){
+    std::osyncstream(std::cerr) << std::format("{}, {}({}): {}\n", slc.file_name(), slc.function_name(), slc.line(), msg);
+}
+
+static void throw_last_sys_error(const std::string& msg, const std::source_location& slc = std::source_location::current()) {
+    auto ec = get_last_sys_ec();
+    throw std::runtime_error{ std::format("{}, {}({}): {}, {}", slc.file_name(), slc.function_name(), slc.line(), msg, ec.message()) };
+}
+
+static void throw_user_error(const std::string& msg, const std::source_location& slc = std::source_location::current()){
+    throw std::runtime_error{ std::format("{}, {}({}): {}", slc.file_name(), slc.function_name(), slc.line(), msg) };
+}
+
+/*
+    transcoding into caller provided buffers.
+    every conversion is a single pass straight into <out>. when <out> is too small, nothing usable is written,
+    <fits> is false and <size> is the length needed, so the caller grows its buffer and converts again,
+    which stops happening once a reused buffer has grown to its working size.
+    only windows needs them, POSIX paths are UTF-8 bytes already, see the path layer below.
+
+    a very tricky thing here is, if the underlying string stored in fs::path <p> ends with '\0',
+    when you pass the <p> to the fs::directory_iterator, you would get a file not found exception.
+    but if I pass <p.c_str()> to the fs::directory_iterator, then that will work as expected. I tested it on
+    the visual studio and clang++, and both represent this bug, but '\0' doesn't influence the functions like
+    fs::is_directory or fs::is_regular_file, so this is really interesting.
+
+    the conversions below always pass the length of the input instead of -1, so the tail '\0' is never produced,
+    and the results could be put into a fs::path directly.
+*/
+struct ConvResult {
+    size_t size;   // characters written, or characters needed if it doesn't fit.
+    bool fits;
+};
+
+/*
+    convert into a reusable buffer, usually a thread_local one, growing it only when it is too small.
+    the returned view is valid until the next conversion into the same buffer.
+    <guess> is the size the output would most likely fit in, so the conversion normally runs once.
+*/
+template <class Char, class Input, class Conv>
+static std::basic_string_view<Char> conv_into(std::basic_string<Char>& scratch, Input input, size_t guess, Conv conv) {
+    if (scratch.size() < guess) {
+        scratch.resize(guess);
+    }
+
+    auto result = conv(input, std::span<Char>{ scratch });
+    if (!result.fits) {
+        scratch.resize(result.size);
+        result = conv(input, std::span<Char>{ scratch });
+    }
+
+    return { scratch.data(), result.size };
+}
+
+#ifdef _WIN32
+static ConvResult conv_to_unicode(UINT codePage, std::string_view str, std::span<wchar_t> out, const char* what) {
+    if (str.empty()) {
+        return { 0, true };
+    }
+
+    auto len = MultiByteToWideChar(codePage, 0, str.data(), static_cast<int>(str.size()), out.data(), static_cast<int>(out.size()));
+    if (len > 0) {
+        return { static_cast<size_t>(len), true };
+    }
+
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+        throw_last_sys_error(what);
+    }
+
+    len = MultiByteToWideChar(codePage, 0, str.data(), static_cast<int>(str.size()), nullptr, 0);
+    if (len == 0) {
+        throw_last_sys_error(what);
+    }
+
+    return { static_cast<size_t>(len), false };
+}
+
+static ConvResult conv_from_unicode(UINT codePage, std::wstring_view wstr, std::span<char> out, const char* what) {
+    if (wstr.empty()) {
+        return { 0, true };
+    }
+
+    auto len = WideCharToMultiByte(codePage, 0, wstr.data(), static_cast<int>(wstr.size()), out.data(), static_cast<int>(out.size()), nullptr, nullptr);
+    if (len > 0) {
+        return { static_cast<size_t>(len), true };
+    }
+
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+        throw_last_sys_error(what);
+    }
+
+    len = WideCharToMultiByte(codePage, 0, wstr.data(), static_cast<int>(wstr.size()), nullptr, 0, nullptr, nullptr);
+    if (len == 0) {
+        throw_last_sys_error(what);
+    }
+
+    return { static_cast<size_t>(len), false };
+}
+
+static ConvResult conv_ascii_to_unicode(std::string_view str, std::span<wchar_t> out) {
+    return conv_to_unicode(CP_ACP, str, out, "conv_ascii_to_unicode() failed");
+}
+
+static ConvResult conv_unicode_to_ascii(std::wstring_view wstr, std::span<char> out) {
+    return conv_from_unicode(CP_ACP, wstr, out, "conv_unicode_to_ascii() failed");
+}
+
+static ConvResult conv_utf8_to_unicode(std::string_view str, std::span<wchar_t> out) {
+    return conv_to_unicode(CP_UTF8, str, out, "conv_utf8_to_unicode() failed");
+}
+
+static ConvResult conv_unicode_to_utf8(std::wstring_view wstr, std::span<char> out) {
+    size_t len = 0;
+    auto put = [&](uint32_t byte) {
+        if (len < out.size()) {
+            out[len] = static_cast<char>(byte);
+        }
+        ++len;
+    };
+
+    for (wchar_t c : wstr) {
+        auto i = static_cast<uint32_t>(c);   // as you can see, the parameter could also be u32string.
+
+        if (i < 0x80) {
+            put(i);
+        }
+        else if (i < 0x800) {
+            put(0xc0 | (i >> 6));
+            put(0x80 | (i & 0x3f));
+        }
+        else if (i < 0x10000) {
+            put(0xe0 | (i >> 12));
+            put(0x80 | ((i >> 6) & 0x3f));
+            put(0x80 | (i & 0x3f));
+        }
+        else if (i < 0x200000) {
+            put(0xf0 | (i >> 18));
+            put(0x80 | ((i >> 12) & 0x3f));
+            put(0x80 | ((i >> 6) & 0x3f));
+            put(0x80 | (i & 0x3f));
+        }
+        else {
+            put(0xf8 | (i >> 24));
+            put(0x80 | ((i >> 18) & 0x3f));
+            put(0x80 | ((i >> 12) & 0x3f));
+            put(0x80 | ((i >> 6) & 0x3f));
+            put(0x80 | (i & 0x3f));
+        }
+    }
+
+    return { len, len <= out.size() };
+}
+
+static std::string_view conv_unicode_to_utf8(std::wstring_view wstr, std::string& scratch) {   // 3 bytes at most for UTF-16.
+    return conv_into(scratch, wstr, wstr.size() * 3, [](std::wstring_view in, std::span<char> out) { return conv_unicode_to_utf8(in, out); });
+}
+
+static std::wstring_view conv_ascii_to_unicode(std::string_view str, std::wstring& scratch) {
+    return conv_into(scratch, str, str.size(), [](std::string_view in, std::span<wchar_t> out) { return conv_ascii_to_unicode(in, out); });
+}
+
+static std::string_view conv_unicode_to_ascii(std::wstring_view wstr, std::string& scratch) {   // double byte code pages need 2 bytes at most.
+    return conv_into(scratch, wstr, wstr.size() * 2, [](std::wstring_view in, std::span<char> out) { return conv_unicode_to_ascii(in, out); });
+}
+
+static std::wstring_view conv_utf8_to_unicode(std::string_view str, std::wstring& scratch) {   // never more characters than bytes.
+    return conv_into(scratch, str, str.size(), [](std::string_view in, std::span<wchar_t> out) { return conv_utf8_to_unicode(in, out); });
+}
+
+static std::string_view conv_utf8_to_ascii(std::string_view str, std::string& scratch) {
+    thread_local std::wstring wideScratch;
+    return conv_unicode_to_ascii(conv_utf8_to_unicode(str, wideScratch), scratch);
+}
+
+// owning versions, for the places that keep the result.
+static std::wstring conv_ascii_to_unicode(const std::string& str) {
+    std::wstring buffer;
+    buffer.resize(conv_ascii_to_unicode(str, buffer).size());
+    return buffer;
+}
+
+static std::string conv_unicode_to_ascii(const std::wstring& wstr) {
+    std::string buffer;
+    buffer.resize(conv_unicode_to_ascii(wstr, buffer).size());
+    return buffer;
+}
+
+static std::wstring conv_utf8_to_unicode(const std::string& str) {
+    std::wstring buffer;
+    buffer.resize(conv_utf8_to_unicode(str, buffer).size());
+    return buffer;
+}
+
+static std::string conv_utf8_to_ascii(const std::string& str) {
+    std::string buffer;
+    buffer.resize(conv_utf8_to_ascii(str, buffer).size());
+    return buffer;
+}
+
+
+static std::string conv_unicode_to_utf8(const std::wstring& wstr) {
+    std::string buffer;
+    buffer.resize(conv_unicode_to_utf8(wstr, buffer).size());
+    return buffer;
+}
+#endif
+
+/*
+    path layer.
+    on windows, paths are UTF-16 and have to be transcoded where they meet the outside: the request uri and the
+    html page are UTF-8, the command line uses the ansi code page.
+    on POSIX systems, paths are bytes, and the server treats them as UTF-8 end to end, so these are all plain views,
+    nothing is converted, and the scratch buffers are never touched.
+*/
+using native_string = fs::path::string_type;
+using native_string_view = std::basic_string_view<fs::path::value_type>;
+
+// root path given on the command line.
+static native_string path_from_command_line(const std::string& arg) {
+#ifdef _WIN32
+    return conv_ascii_to_unicode(arg);
+#else
+    return arg;
+#endif
+}
+
+/*
+* /__top, /__connections and /__trace show the paths and addresses of other clients, and /__trace switches
+* tracing, so they are off unless the server is started with --admin, and even then only for a client on
+* the same machine. when off they are plain paths in the root.
+*/
+static bool adminEndpoints = false;
+
+static bool is_loopback(const sockaddr_storage& client) noexcept {
+    if (client.ss_family == AF_INET) {
+        return (ntohl(reinterpret_cast<const sockaddr_in&>(client).sin_addr.s_addr) >> 24) == 127;
+    }
+
+    if (client.ss_family == AF_INET6) {
+        const auto& addr = reinterpret_cast<const sockaddr_in6&>(client).sin6_addr;
+        return IN6_IS_ADDR_LOOPBACK(&addr) || (IN6_IS_ADDR_V4MAPPED(&addr) && addr.s6_addr[12] == 127);
+    }
+    return false;
+}
+
+/*
+* decoded request uri (UTF-8) to a path relative to the root, false if it would name something outside of it.
+* the uri starts with '/', and appending a path with a root directory to another path replaces everything but
+* the root name (the drive on windows), so it is stripped. the uri is decoded already, so "%2e%2e" is ".." here:
+* "." and ".." segments are refused, and a NUL, which would cut the path short. on windows '\' is a separator
+* too, and ':' starts a drive ("C:") or an alternate data stream, both are refused.
+*/
+static bool path_from_uri(std::string_view uri, native_string& scratch, native_string_view& relative) {
+    auto pos = uri.find_first_not_of('/');
+    uri = pos == std::string_view::npos ? std::string_view{} : uri.substr(pos);
+
+#ifdef _WIN32
+    constexpr std::string_view SEPARATORS = "/\\";
+    if (uri.find_first_of(std::string_view{ ":\0", 2 }) != std::string_view::npos) {
+        return false;
+    }
+#else
+    constexpr std::string_view SEPARATORS = "/";
+    if (uri.find('\0') != std::string_view::npos) {
+        return false;
+    }
+#endif
+
+    for (size_t begin = 0; begin <= uri.size();) {
+        auto end = std::min(uri.find_first_of(SEPARATORS, begin), uri.size());
+        auto segment = uri.substr(begin, end - begin);
+        if (segment == "." || segment == "..") {
+            return false;
+        }
+        begin = end + 1;
+    }
+
+#ifdef _WIN32
+    relative = conv_utf8_to_unicode(uri, scratch);   // It is necessary to use Unicode to process paths on the Windows platform.
+#else
+    (void)scratch;
+    relative = uri;
+#endif
+    return true;
+}
+
+// path or name to UTF-8, for html pages.
+static std::string_view path_to_utf8(native_string_view path, std::string& scratch) {
+#ifdef _WIN32
+    return conv_unicode_to_utf8(path, scratch);
+#else
+    (void)scratch;
+    return path;
+#endif
+}
+
+// the last component of <p>, without building a new fs::path for it like p.filename() does.
+static native_string_view filename_view(const fs::path& p) {
+#ifdef _WIN32
+    constexpr native_string_view separators = L"\\/";
+#else
+    constexpr native_string_view separators = "/";
+#endif
+
+    native_string_view native = p.native();
+    auto pos = native.find_last_of(separators);
+    return pos == native_string_view::npos ? native : native.substr(pos + 1);
+}
+
+/*
+    growable output buffer.
+    it is kept per thread and reused by every response, once it has grown to the size of the
+    largest page rendered on that thread, rendering doesn't allocate any more.
+*/
+class OutputBuffer {
+    std::unique_ptr<char[]> data;
+    size_t len = 0;
+    size_t cap = 0;
+public:
+    void clear() noexcept {
+        len = 0;
+    }
+
+    void reserve(size_t n) {
+        if (n <= cap) {
+            return;
+        }
+
+        auto newCap = std::max(n, cap * 2);
+        auto newData = std::make_unique<char[]>(newCap);
+        std::copy_n(data.get(), len, newData.get());
+        data = std::move(newData);
+        cap = newCap;
+    }
+
+    // make room for at least <n> bytes, write them through the returned pointer, then commit() what was written.
+    char* prepare(size_t n) {
+        reserve(len + n);
+        return data.get() + len;
+    }
+
+    void commit(size_t n) noexcept {
+        len += n;
+    }
+
+    void append(std::string_view str) {
+        std::copy(str.begin(), str.end(), prepare(str.size()));
+        commit(str.size());
+    }
+
+    void append_number(uintmax_t value) {
+        constexpr size_t MAX_DIGITS = 20;
+        auto begin = prepare(MAX_DIGITS);
+        auto [ptr, ec] = std::to_chars(begin, begin + MAX_DIGITS, value);
+        commit(ptr - begin);
+    }
+
+    size_t size() const noexcept {
+        return len;
+    }
+
+    std::string_view view() const noexcept {
+        return { data.get(), len };
+    }
+};
+
+/*
+    compile-time html template.
+    the text is split at every "{}" before the program runs, rendering is just appending the fixed parts
+    and the fields in turn, and the size of the fixed parts is known for estimating the output size.
+*/
+template <size_t Fields>
+class HtmlTemplate {
+    std::array<std::string_view, Fields + 1> parts;
+    size_t fixedSize = 0;
+
+    static void append_field(OutputBuffer& out, std::string_view field) {
+        out.append(field);
+    }
+
+    template <class Field>
+    static auto append_field(OutputBuffer& out, const Field& field) -> decltype(field.append_to(out)) {
+        field.append_to(out);
+    }
+public:
+    consteval HtmlTemplate(std::string_view text) {
+        size_t begin = 0;
+
+        for (size_t i = 0; i < Fields; ++i) {
+            auto pos = text.find("{}", begin);
+            if (pos == std::string_view::npos) {
+                throw "html template has fewer fields than declared";
+            }
+
+            parts[i] = text.substr(begin, pos - begin);
+            begin = pos + 2;
+        }
+
+        parts[Fields] = text.substr(begin);
+        if (parts[Fields].find("{}") != std::string_view::npos) {
+            throw "html template has more fields than declared";
+        }
+
+        for (auto part : parts) {
+            fixedSize += part.size();
+        }
+    }
+
+    constexpr size_t fixed_size() const noexcept {
+        return fixedSize;
+    }
+
+    template <class... Args>
+    void render(OutputBuffer& out, const Args&... fields) const {
+        static_assert(sizeof...(Args) == Fields, "wrong number of fields for this html template");
+
+        size_t i = 0;
+        ((out.append(parts[i++]), append_field(out, fields)), ...);
+        out.append(parts[Fields]);
+    }
+};
+
+// beautify format, the longest result is 20 digits plus " Bytes".
+constexpr size_t FILE_SIZE_MAX_LEN = 26;
+
+static void build_file_size(OutputBuffer& out, uintmax_t size) {
+    if (size < 1024) {
+        out.append_number(size);
+        out.append(" Bytes");
+    }
+    else if (size >= 1024 && size < 1024 * 1024) {
+        out.append_number(size / 1024);
+        out.append(" KB");
+    }
+    else if (size >= 1024 * 1024 && size < 1024 * 1024 * 1024) {
+        out.append_number(size / 1024 / 1024);
+        out.append(" MB");
+    }
+    else {
+        out.append_number(size / 1024 / 1024 / 1024);
+        out.append(" GB");
+    }
+}
+
+// html template field, formats the size straight into the output buffer.
+struct FileSizeField {
+    uintmax_t size;
+
+    void append_to(OutputBuffer& out) const {
+        build_file_size(out, size);
+    }
+};
+
+constexpr HtmlTemplate<1> LISTING_HEAD_TEMPLATE{ "<html><header><h1>Miku Server</h1></header><body>Current dir: {}<br><br>" };
+constexpr HtmlTemplate<2> LISTING_DIR_TEMPLATE{ "<a href='{}/'>{}/</a><br>" };
+constexpr HtmlTemplate<3> LISTING_FILE_TEMPLATE{ "<a href='{}'>{}</a>   {} <br>" };
+constexpr HtmlTemplate<0> LISTING_TAIL_TEMPLATE{ "</body></html>" };
+
+/*
+    escaping of the names put into the listing.
+    a name goes into href='...' percent-encoded, and into the link text html-escaped. the percent-encoded form
+    has no quote, '<' or '&' left, so it is also safe as the html attribute value.
+    UTF-8 bytes are kept as they are in the url, the browser encodes them itself, and uri_decode() accepts both.
+    ':' is encoded too, or a name like "javascript:alert(1)" or "a:b.txt" would be read as the scheme of the link.
+*/
+enum : uint8_t {
+    ESCAPE_URL = 1,
+    ESCAPE_HTML = 2
+};
+
+constexpr auto ESCAPE_TABLE = []() {
+    std::array<uint8_t, 256> table{};
+
+    for (int c = 0; c <= 0x20; ++c) {   // control characters and space.
+        table[c] = ESCAPE_URL;
+    }
+
+    for (unsigned char c : std::string_view{ "\"#%':<>?[\\]^`{|}\x7f" }) {
+        table[c] = ESCAPE_URL;
+    }
+
+    for (unsigned char c : std::string_view{ "&<>\"'" }) {
+        table[c] |= ESCAPE_URL | ESCAPE_HTML;
+    }
+
+    return table;
+}();
+
+#ifdef HFS_ESCAPE_SSE2
+/*
+    one bit per byte of the 16 bytes that might need escaping.
+    the ranges are a superset of ESCAPE_TABLE ('$', ';', '=' and '~' are caught too), false positives only
+    send a byte to the table lookup, runs of safe bytes (including all UTF-8 bytes) are copied 16 at a time.
+*/
+static inline uint32_t escape_mask(__m128i v) {
+    auto in_range = [v](char lo, char hi) {
+        auto shifted = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+        auto limit = _mm_set1_epi8(static_cast<char>(hi - lo));
+        return _mm_cmpeq_epi8(_mm_min_epu8(shifted, limit), shifted);   // unsigned shifted <= limit.
+    };
+
+    auto mask = in_range(0x00, 0x20);
+    mask = _mm_or_si128(mask, in_range(0x22, 0x27));   // " # $ % & '
+    mask = _mm_or_si128(mask, in_range(0x3a, 0x3f));   // : ; < = > ?
+    mask = _mm_or_si128(mask, in_range(0x5b, 0x5e));   // [ \ ] ^
+    mask = _mm_or_si128(mask, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x60)));   // `
+    mask = _mm_or_si128(mask, in_range(0x7b, 0x7f));   // { | } ~ DEL
+
+    return static_cast<uint32_t>(_mm_movemask_epi8(mask));
+}
+#endif
+
+// the longest escapes are "%XX" in the url and "&quot;" in html.
+constexpr size_t ESCAPE_URL_MAX_RATIO = 3;
+constexpr size_t ESCAPE_HTML_MAX_RATIO = 6;
+
+static inline void escape_byte(unsigned char c, char*& url, char*& html) {
+    static constexpr char HEX[] = "0123456789ABCDEF";
+    auto flags = ESCAPE_TABLE[c];
+
+    if (url != nullptr) {
+        if (flags & ESCAPE_URL) {
+            *url++ = '%';
+            *url++ = HEX[c >> 4];
+            *url++ = HEX[c & 0xf];
+        }
+        else {
+            *url++ = static_cast<char>(c);
+        }
+    }
+
+    if (flags & ESCAPE_HTML) {
+        std::string_view entity;
+        switch (c) {
+        case '&': entity = "&amp;"; break;
+        case '<': entity = "&lt;"; break;
+        case '>': entity = "&gt;"; break;
+        case '"': entity = "&quot;"; break;
+        default: entity = "&#39;"; break;
+        }
+        html = std::copy(entity.begin(), entity.end(), html);
+    }
+    else {
+        *html++ = static_cast<char>(c);
+    }
+}
+
+// length of the prefix of <name> that needs no escaping in either form.
+static size_t escape_clean_prefix(std::string_view name) {
+    auto n = name.size();
+    auto in = reinterpret_cast<const unsigned char*>(name.data());
+    size_t i = 0;
+
+#ifdef HFS_ESCAPE_SSE2
+    constexpr size_t CHUNK = 16;
+
+    for (; i + CHUNK <= n; i += CHUNK) {
+        auto mask = escape_mask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+        if (mask != 0) {
+            return i + std::countr_zero(mask);
+        }
+    }
+
+    if (i < n && n >= CHUNK) {   // the last chunk overlaps what was checked already.
+        auto shift = CHUNK - (n - i);
+        auto mask = escape_mask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + n - CHUNK))) >> shift;
+        return mask == 0 ? n : i + std::countr_zero(mask);
+    }
+#endif
+
+    for (; i < n; ++i) {
+        if (ESCAPE_TABLE[in[i]] != 0) {
+            return i;
+        }
+    }
+
+    return n;
+}
+
+/*
+    escape <name> in one pass, appending the percent-encoded form to <url> (if given) and the html-escaped form to <html>.
+    both outputs reserve the worst case first, so the loop writes through raw pointers.
+*/
+static void escape_name(std::string_view name, OutputBuffer* url, OutputBuffer& html) {
+    constexpr size_t CHUNK = 16;   // slack for the whole-chunk stores below.
+
+    auto n = name.size();
+    auto in = reinterpret_cast<const unsigned char*>(name.data());
+    char* urlBegin = url != nullptr ? url->prepare(n * ESCAPE_URL_MAX_RATIO + CHUNK) : nullptr;
+    char* htmlBegin = html.prepare(n * ESCAPE_HTML_MAX_RATIO + CHUNK);
+    char* u = urlBegin;
+    char* h = htmlBegin;
+    size_t i = 0;
+
+#ifdef HFS_ESCAPE_SSE2
+    /*
+        the last chunk is copied into a zero-padded block, the padding is flagged like any control character,
+        so the safe prefix never runs past the end of the name. the whole chunk is stored to the outputs,
+        but they only move forward by the safe prefix.
+    */
+    while (i < n) {
+        auto left = n - i;
+        __m128i v;
+
+        if (left >= CHUNK) {
+            v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        }
+        else {
+            alignas(16) unsigned char tail[CHUNK]{};
+            std::memcpy(tail, in + i, left);
+            v = _mm_load_si128(reinterpret_cast<const __m128i*>(tail));
+        }
+
+        auto safe = static_cast<size_t>(std::countr_zero(escape_mask(v) | (1u << CHUNK)));
+
+        if (u != nullptr) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(u), v);
+            u += safe;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h), v);
+        h += safe;
+        i += safe;
+
+        if (safe < CHUNK && i < n) {
+            escape_byte(in[i++], u, h);
+        }
+    }
+#else
+    for (; i < n; ++i) {
+        escape_byte(in[i], u, h);
+    }
+#endif
+
+    if (url != nullptr) {
+        url->commit(u - urlBegin);
+    }
+    html.commit(h - htmlBegin);
+}
+
+// html template field, escapes the text straight into the output buffer.
+struct HtmlEscapedField {
+    std::string_view text;
+
+    void append_to(OutputBuffer& out) const {
+        escape_name(text, nullptr, out);
+    }
+};
+
+/*
+    metrics.
+    every thread counts into its own ThreadMetrics, written only by that thread, so counting is a relaxed load
+    and store to a line nobody else writes. a scrape of /__metrics sums all of them, the only lock is the one
+    taken when a thread registers its metrics.
+*/
+class Counter {
+    std::atomic<uint64_t> value{ 0 };
+public:
+    void add(uint64_t n = 1) noexcept {   // single writer, no need for a locked add.
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const noexcept {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+/*
+    HDR-style histogram of microseconds.
+    a value below SUB_BUCKETS has its own bucket, above that, every power of 2 is split into SUB_BUCKETS linear
+    buckets, so any value is recorded with less than 1 / SUB_BUCKETS relative error, from 1us up to MAX_US.
+*/
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t{ 1 } << SUB_BITS;
+    static constexpr uint64_t MAX_US = (uint64_t{ 1 } << 40) - 1;   // about 12 days.
+    static constexpr size_t BUCKETS = (std::bit_width(MAX_US) - SUB_BITS + 1) * SUB_BUCKETS;
+
+    using Snapshot = std::array<uint64_t, BUCKETS>;
+private:
+    std::array<Counter, BUCKETS> counts;
+    Counter sum;
+public:
+    static size_t bucket_index(uint64_t us) noexcept {
+        us = std::min(us, MAX_US);
+        if (us < SUB_BUCKETS) {
+            return static_cast<size_t>(us);
+        }
+
+        auto shift = std::bit_width(us) - 1 - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + static_cast<size_t>((us >> shift) - SUB_BUCKETS);
+    }
+
+    // the largest value recorded in bucket <index>.
+    static uint64_t bucket_upper(size_t index) noexcept {
+        auto group = index / SUB_BUCKETS;
+        auto sub = index % SUB_BUCKETS;
+        if (group == 0) {
+            return sub;
+        }
+
+        return ((SUB_BUCKETS + sub + 1) << (group - 1)) - 1;
+    }
+
+    void record(uint64_t us) noexcept {
+        counts[bucket_index(us)].add();
+        sum.add(us);
+    }
+
+    void merge_into(Snapshot& snapshot, uint64_t& sumUs) const noexcept {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            snapshot[i] += counts[i].get();
+        }
+        sumUs += sum.get();
+    }
+};
+
+/*
+    resources used by the calling thread, so the difference of two samples taken around a request is what
+    the request cost. linux has all of them per thread. windows only has the cpu time per thread, counted
+    in scheduler ticks, so a short request often shows 0 there, the other fields stay 0.
+*/
+struct ResourceUsage {
+    uint64_t cpuUs = 0;   // user + system.
+    uint64_t minorFaults = 0;
+    uint64_t majorFaults = 0;
+    uint64_t voluntarySwitches = 0;
+
+    static ResourceUsage of_this_thread() noexcept {
+        ResourceUsage usage;
+#ifdef _WIN32
+        FILETIME creation, exit, kernel, user;
+        if (GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+            auto ticks = [](FILETIME t) { return (uint64_t{ t.dwHighDateTime } << 32) | t.dwLowDateTime; };
+            usage.cpuUs = (ticks(kernel) + ticks(user)) / 10;   // in 100ns.
+        }
+#elif defined(RUSAGE_THREAD)
+        rusage ru;
+        if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+            usage.cpuUs = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * uint64_t{ 1000000 } + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+            usage.minorFaults = ru.ru_minflt;
+            usage.majorFaults = ru.ru_majflt;
+            usage.voluntarySwitches = ru.ru_nvcsw;
+        }
+#else
+        timespec ts;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+            usage.cpuUs = ts.tv_sec * uint64_t{ 1000000 } + ts.tv_nsec / 1000;
+        }
+#endif
+        return usage;
+    }
+
+    ResourceUsage operator-(const ResourceUsage& other) const noexcept {
+        return { cpuUs - other.cpuUs, minorFaults - other.minorFaults, majorFaults - other.majorFaults, voluntarySwitches - other.voluntarySwitches };
+    }
+};
+
+/*
+    what the kernel knows about a tcp connection, TCP_INFO on linux, SIO_TCP_INFO on windows.
+    the counters are totals of the connection so far. windows counts the limited times in milliseconds and has
+    no delivery rate, which stays 0, as does every field on a platform or kernel that doesn't report it.
+*/
+struct TcpSample {
+    uint32_t rttUs = 0;    // smoothed.
+    uint32_t cwnd = 0;     // bytes.
+    uint32_t retransmits = 0;
+    uint64_t deliveryRate = 0;   // bytes per second, the kernel's estimate of the most recent delivery.
+    uint64_t busyUs = 0;         // time with data to send.
+    uint64_t rwndLimitedUs = 0;  // time the peer's receive window held the sender back.
+
+    static TcpSample of(SOCKET sock) noexcept {
+        TcpSample sample;
+#if defined(__linux__)
+        tcp_info info{};
+        socklen_t len = sizeof(info);   // an older kernel fills less, the rest stays 0.
+        if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+            sample.rttUs = info.tcpi_rtt;
+            sample.cwnd = info.tcpi_snd_cwnd * info.tcpi_snd_mss;
+            sample.retransmits = info.tcpi_total_retrans;
+            sample.deliveryRate = info.tcpi_delivery_rate;
+            sample.busyUs = info.tcpi_busy_time;
+            sample.rwndLimitedUs = info.tcpi_rwnd_limited;
+        }
+#elif defined(_WIN32) && defined(SIO_TCP_INFO)
+        DWORD version = 1;
+        TCP_INFO_v1 info{};
+        DWORD len = 0;
+        if (WSAIoctl(sock, SIO_TCP_INFO, &version, sizeof(version), &info, sizeof(info), &len, nullptr, nullptr) == 0) {
+            sample.rttUs = info.RttUs;
+            sample.cwnd = info.Cwnd;
+            sample.retransmits = info.FastRetrans + info.TimeoutEpisodes;
+            sample.busyUs = (uint64_t{ info.SndLimTimeRwin } + info.SndLimTimeCwnd + info.SndLimTimeSnd) * 1000;
+            sample.rwndLimitedUs = uint64_t{ info.SndLimTimeRwin } * 1000;
+        }
+#else
+        (void)sock;
+#endif
+        return sample;
+    }
+};
+
+/*
+    the accept queue of a listening socket, linux only.
+    TCP_INFO on a listener reports the connections waiting for accept() and the backlog, the overflows and
+    drops are counted by the kernel for all the listeners of the host, in /proc/net/netstat.
+*/
+struct ListenQueue {
+    bool valid = false;
+    uint32_t length = 0;
+    uint32_t limit = 0;
+    uint64_t overflows = 0;   // the queue was full when a handshake completed.
+    uint64_t drops = 0;       // a connection request was dropped, overflows included.
+
+    static ListenQueue of(SOCKET listener) {
+        ListenQueue queue;
+#ifdef __linux__
+        tcp_info info{};
+        socklen_t len = sizeof(info);
+        if (listener == INVALID_SOCKET || getsockopt(listener, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+            return queue;
+        }
+
+        queue.valid = true;
+        queue.length = info.tcpi_unacked;
+        queue.limit = info.tcpi_sacked;
+
+        // two "TcpExt:" lines, the names and then the values.
+        std::ifstream netstat{ "/proc/net/netstat" };
+        std::string names, values;
+        while (std::getline(netstat, names)) {
+            if (names.starts_with("TcpExt:") && std::getline(netstat, values)) {
+                std::istringstream nameStream{ names }, valueStream{ values };
+                std::string name;
+                uint64_t value;
+
+                nameStream >> name;
+                valueStream >> name;
+                while (nameStream >> name && valueStream >> value) {
+                    if (name == "ListenOverflows") {
+                        queue.overflows = value;
+                    }
+                    else if (name == "ListenDrops") {
+                        queue.drops = value;
+                    }
+                }
+                break;
+            }
+        }
+#else
+        (void)listener;
+#endif
+        return queue;
+    }
+};
+
+/*
+    <str> as the value of a quoted field of a text line, like path="...": '"' and '\' get a '\' before them, and
+    control bytes are written as \xNN, so a client can't end the field or start a line of its own.
+    <Out> is std::string or OutputBuffer.
+*/
+template <class Out>
+static void append_escaped(Out& out, std::string_view str) {
+    constexpr std::string_view HEX_DIGITS = "0123456789abcdef";
+
+    size_t begin = 0;
+    for (size_t i = 0; i < str.size(); ++i) {
+        auto c = static_cast<unsigned char>(str[i]);
+        if (c != '"' && c != '\\' && c >= 0x20 && c != 0x7f) {
+            continue;
+        }
+
+        out.append(str.substr(begin, i - begin));
+        if (c == '"' || c == '\\') {
+            const char escaped[] = { '\\', static_cast<char>(c) };
+            out.append(std::string_view{ escaped, sizeof(escaped) });
+        }
+        else {
+            const char escaped[] = { '\\', 'x', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0xf] };
+            out.append(std::string_view{ escaped, sizeof(escaped) });
+        }
+        begin = i + 1;
+    }
+    out.append(str.substr(begin));
+}
+
+// the first directory of a request path, like "/docs" for "/docs/a/b.txt" or "//docs/a", or "/" for a file in the root.
+static std::string_view path_prefix(std::string_view path) noexcept {
+    auto begin = path.find_first_not_of('/');
+    if (begin == std::string_view::npos) {
+        return "/";
+    }
+
+    auto end = path.find('/', begin);
+    if (end == std::string_view::npos) {
+        return "/";
+    }
+
+    return path.substr(begin - 1, end - begin + 1);
+}
+
+/*
+    resources used per path prefix, owned by one thread.
+    a fixed open addressing table, a slot's prefix is written once and then published by <used>, so the owner
+    never locks, and a scrape reads the published slots while they are counted. once the table is full, new
+    prefixes are counted in the last slot, named "other".
+*/
+class PrefixUsageTable {
+public:
+    static constexpr size_t PREFIX_LEN = 64;
+
+    struct Slot {
+        std::atomic<bool> used{ false };
+        uint8_t prefixLen = 0;
+        std::array<char, PREFIX_LEN> prefix;
+        Counter requests;
+        Counter cpuUs;
+        Counter minorFaults;
+        Counter majorFaults;
+        Counter voluntarySwitches;
+
+        std::string_view name() const noexcept {
+            return { prefix.data(), prefixLen };
+        }
+    };
+private:
+    std::array<Slot, HTTP_PREFIX_TABLE_LEN> slots;
+    size_t usedSlots = 0;
+
+    Slot& find_or_add(std::string_view prefix) noexcept {
+        prefix = prefix.substr(0, PREFIX_LEN);
+
+        constexpr size_t TABLE_LEN = HTTP_PREFIX_TABLE_LEN - 1;   // the last slot is "other".
+        auto index = std::hash<std::string_view>{}(prefix) % TABLE_LEN;
+
+        for (size_t probe = 0; probe < TABLE_LEN; ++probe, index = (index + 1) % TABLE_LEN) {
+            auto& slot = slots[index];
+
+            if (!slot.used.load(std::memory_order_relaxed)) {   // only this thread writes <used>.
+                if (usedSlots * 4 >= TABLE_LEN * 3) {   // keep probes short.
+                    break;
+                }
+
+                ++usedSlots;
+                slot.prefixLen = static_cast<uint8_t>(prefix.size());
+                std::copy(prefix.begin(), prefix.end(), slot.prefix.data());
+                slot.used.store(true, std::memory_order_release);
+                return slot;
+            }
+
+            if (slot.name() == prefix) {
+                return slot;
+            }
+        }
+
+        auto& other = slots.back();
+        if (!other.used.load(std::memory_order_relaxed)) {
+            other.prefixLen = 5;
+            std::copy_n("other", 5, other.prefix.data());
+            other.used.store(true, std::memory_order_release);
+        }
+        return other;
+    }
+public:
+    void count(std::string_view prefix, const ResourceUsage& usage) noexcept {
+        auto& slot = find_or_add(prefix);
+        slot.requests.add();
+        slot.cpuUs.add(usage.cpuUs);
+        slot.minorFaults.add(usage.minorFaults);
+        slot.majorFaults.add(usage.majorFaults);
+        slot.voluntarySwitches.add(usage.voluntarySwitches);
+    }
+
+    template <class Func>
+    void for_each(Func&& func) const {
+        for (auto& slot : slots) {
+            if (slot.used.load(std::memory_order_acquire)) {
+                func(slot);
+            }
+        }
+    }
+};
+
+/*
+    streaming top-k of one thread, Space-Saving: K slots, a key already in a slot adds 1 to its count, a new key
+    takes the slot with the smallest count and starts from that count + 1, keeping the old count as its error.
+    a key counted more than 1 / K of the requests is always in a slot, its count is an upper bound off by at
+    most its error.
+    counts decay by half every HTTP_HEAVY_WINDOW_SEC, so they follow the traffic of the last few windows.
+    keys are matched by a 64 bit hash of at most KEY_LEN bytes, a collision would only merge two counts.
+    only the owner thread writes, a hit is one relaxed store. a reader could race with a new key taking a slot,
+    each slot has a sequence number, odd while it is rewritten, like a seqlock, so a reader never sees half a key.
+*/
+class SpaceSaving {
+public:
+    static constexpr size_t KEY_LEN = 64;
+    static constexpr size_t KEY_WORDS = KEY_LEN / sizeof(uint64_t);
+
+    struct Entry {
+        uint64_t count;
+        uint64_t error;
+        std::string key;
+    };
+private:
+    struct Key {
+        std::atomic<uint32_t> seq{ 0 };
+        std::atomic<uint32_t> len{ 0 };
+        std::array<std::atomic<uint64_t>, KEY_WORDS> words{};
+    };
+
+    static constexpr size_t INDEX_LEN = std::bit_ceil(size_t{ 2 } * HTTP_HEAVY_HITTERS);   // at most half full.
+    static constexpr uint8_t INDEX_EMPTY = 0xff;
+    static_assert(HTTP_HEAVY_HITTERS < INDEX_EMPTY);
+
+    // only used by the owner: the hash of each slot, and hash -> slot with linear probing.
+    std::array<uint64_t, HTTP_HEAVY_HITTERS> hashes{};
+    std::array<uint8_t, INDEX_LEN> index;
+
+    // the counts scanned for the smallest one are kept apart from the keys, so a scan touches a few cache lines.
+    std::array<std::atomic<uint64_t>, HTTP_HEAVY_HITTERS> counts{};
+    std::array<std::atomic<uint64_t>, HTTP_HEAVY_HITTERS> errors{};
+    std::array<Key, HTTP_HEAVY_HITTERS> keys;
+    size_t used = 0;
+    std::atomic<uint64_t> epoch{ 0 };
+
+    // a few multiplies per 8 bytes, std::hash would take a good part of a count.
+    static uint64_t key_hash(std::string_view key) noexcept {
+        constexpr uint64_t MUL = 0x9e3779b97f4a7c15;
+        uint64_t hash = key.size() * MUL;
+
+        while (key.size() >= 8) {
+            uint64_t word;
+            std::memcpy(&word, key.data(), 8);
+            hash = std::rotl((hash ^ word) * MUL, 29);
+            key.remove_prefix(8);
+        }
+
+        uint64_t tail = 0;
+        std::memcpy(&tail, key.data(), key.size());
+        hash = (hash ^ tail) * MUL;
+
+        return hash ^ (hash >> 32);
+    }
+
+    size_t find(uint64_t hash) const noexcept {
+        for (auto i = hash % INDEX_LEN; index[i] != INDEX_EMPTY; i = (i + 1) % INDEX_LEN) {
+            if (hashes[index[i]] == hash) {
+                return index[i];
+            }
+        }
+        return HTTP_HEAVY_HITTERS;
+    }
+
+    void index_insert(size_t slot) noexcept {
+        auto i = hashes[slot] % INDEX_LEN;
+        while (index[i] != INDEX_EMPTY) {
+            i = (i + 1) % INDEX_LEN;
+        }
+        index[i] = static_cast<uint8_t>(slot);
+    }
+
+    // backward shift deletion, so no tombstones pile up.
+    void index_erase(size_t slot) noexcept {
+        auto i = hashes[slot] % INDEX_LEN;
+        while (index[i] != slot) {
+            i = (i + 1) % INDEX_LEN;
+        }
+
+        for (auto j = (i + 1) % INDEX_LEN; index[j] != INDEX_EMPTY; j = (j + 1) % INDEX_LEN) {
+            auto home = hashes[index[j]] % INDEX_LEN;
+            if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {   // <home> isn't in (i, j].
+                index[i] = index[j];
+                i = j;
+            }
+        }
+        index[i] = INDEX_EMPTY;
+    }
+
+    void decay(uint64_t now) noexcept {
+        auto shift = std::min<uint64_t>(now - epoch.load(std::memory_order_relaxed), 63);
+
+        for (size_t i = 0; i < used; ++i) {
+            counts[i].store(counts[i].load(std::memory_order_relaxed) >> shift, std::memory_order_relaxed);
+            errors[i].store(errors[i].load(std::memory_order_relaxed) >> shift, std::memory_order_relaxed);
+        }
+        epoch.store(now, std::memory_order_release);
+    }
+
+    void replace(size_t slot, uint64_t hash, std::string_view key, uint64_t count, uint64_t error) noexcept {
+        if (slot < used) {
+            index_erase(slot);
+        }
+        hashes[slot] = hash;
+        index_insert(slot);
+
+        std::array<uint64_t, KEY_WORDS> words{};
+        std::memcpy(words.data(), key.data(), key.size());
+
+        auto& k = keys[slot];
+        auto seq = k.seq.load(std::memory_order_relaxed);
+        k.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (size_t i = 0; i < KEY_WORDS; ++i) {
+            k.words[i].store(words[i], std::memory_order_relaxed);
+        }
+        k.len.store(static_cast<uint32_t>(key.size()), std::memory_order_relaxed);
+        counts[slot].store(count, std::memory_order_relaxed);
+        errors[slot].store(error, std::memory_order_relaxed);
+
+        k.seq.store(seq + 2, std::memory_order_release);
+    }
+public:
+    SpaceSaving() {
+        index.fill(INDEX_EMPTY);
+    }
+
+    // <now> counts windows, like steady time / HTTP_HEAVY_WINDOW_SEC.
+    void count(std::string_view key, uint64_t now) noexcept {
+        if (now != epoch.load(std::memory_order_relaxed)) {
+            decay(now);
+        }
+
+        key = { key.data(), std::min(key.size(), KEY_LEN) };
+        auto hash = key_hash(key);
+
+        auto slot = find(hash);
+        if (slot != HTTP_HEAVY_HITTERS) {
+            counts[slot].store(counts[slot].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        if (used < HTTP_HEAVY_HITTERS) {
+            replace(used, hash, key, 1, 0);
+            ++used;
+            return;
+        }
+
+        size_t minSlot = 0;
+        uint64_t minCount = counts[0].load(std::memory_order_relaxed);
+        for (size_t i = 1; i < counts.size(); ++i) {
+            auto c = counts[i].load(std::memory_order_relaxed);
+            if (c < minCount) {
+                minSlot = i;
+                minCount = c;
+            }
+        }
+
+        replace(minSlot, hash, key, minCount + 1, minCount);
+    }
+
+    // appends the entries, decayed up to <now>, may be called from any thread.
+    void snapshot(std::vector<Entry>& entries, uint64_t now) const {
+        auto shift = std::min<uint64_t>(now - std::min(now, epoch.load(std::memory_order_acquire)), 63);
+
+        for (size_t slot = 0; slot < keys.size(); ++slot) {
+            auto& k = keys[slot];
+            std::array<uint64_t, KEY_WORDS> words;
+            uint64_t count, error;
+            uint32_t len;
+            uint32_t seq;
+
+            do {
+                seq = k.seq.load(std::memory_order_acquire);
+                for (size_t i = 0; i < KEY_WORDS; ++i) {
+                    words[i] = k.words[i].load(std::memory_order_relaxed);
+                }
+                len = std::min<uint32_t>(k.len.load(std::memory_order_relaxed), KEY_LEN);
+                count = counts[slot].load(std::memory_order_relaxed);
+                error = errors[slot].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((seq & 1) != 0 || seq != k.seq.load(std::memory_order_relaxed));
+
+            if (len != 0 && (count >> shift) != 0) {
+                entries.push_back({ count >> shift, error >> shift, std::string(reinterpret_cast<const char*>(words.data()), len) });
+            }
+        }
+    }
+};
+
+// the directory part of a request path, like "/docs/" for "/docs/a.txt", a directory request is itself.
+static std::string_view path_directory(std::string_view path) noexcept {
+    auto end = path.rfind('/');
+    return end == std::string_view::npos ? "/" : path.substr(0, end + 1);
+}
+
+struct HeavyHitters {
+    SpaceSaving paths;
+    SpaceSaving dirs;
+    SpaceSaving clients;   // family and address bytes, like AccessRecord.
+
+    static uint64_t window_of(std::chrono::steady_clock::time_point time) noexcept {
+        return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count() / HTTP_HEAVY_WINDOW_SEC;
+    }
+
+    // <time> is a timestamp the request already took, reading the clock again would cost more than the counting.
+    void count(std::string_view path, const sockaddr_storage& client, std::chrono::steady_clock::time_point time) noexcept {
+        auto now = window_of(time);
+        paths.count(path, now);
+        dirs.count(path_directory(path), now);
+
+        std::array<char, 17> key{ static_cast<char>(client.ss_family) };
+        size_t keyLen = 1;
+        if (client.ss_family == AF_INET) {
+            std::memcpy(key.data() + 1, &reinterpret_cast<const sockaddr_in&>(client).sin_addr, 4);
+            keyLen += 4;
+        }
+        else if (client.ss_family == AF_INET6) {
+            std::memcpy(key.data() + 1, &reinterpret_cast<const sockaddr_in6&>(client).sin6_addr, 16);
+            keyLen += 16;
+        }
+        clients.count({ key.data(), keyLen }, now);
+    }
+};
+
+constexpr std::array<uint16_t, 5> METRICS_STATUSES{ 200, 404, 405, 414, 500 };   // the codes this server sends.
+
+/*
+    stages of a request, each one ends at a timestamp taken by HttpConnection:
+    queue: accepted -> a worker starts the connection.
+    recv: -> the request is received.
+    parse: -> the request line is parsed and the uri decoded.
+    resolve: -> the path is built and stat()'ed.
+    build: -> the response is ready to send (file read, listing rendered).
+    send: -> the response is sent.
+    a stage that a request skips (an error response before the stat) takes no time, and the next one covers it.
+*/
+enum RequestStage : size_t {
+    STAGE_QUEUE,
+    STAGE_RECV,
+    STAGE_PARSE,
+    STAGE_RESOLVE,
+    STAGE_BUILD,
+    STAGE_SEND,
+    STAGE_COUNT
+};
+
+constexpr std::array<std::string_view, STAGE_COUNT> STAGE_NAMES{ "queue", "recv", "parse", "resolve", "build", "send" };
+
+struct alignas(64) ThreadMetrics {
+    std::array<Counter, METRICS_STATUSES.size() + 1> requests;   // by status, the last one for any other code.
+    Counter bytesSent;
+    Counter connectionsAccepted;   // by the accepting thread.
+    Counter connectionsClosed;     // by the workers.
+    Counter tasksQueued;
+    Counter tasksStarted;
+    Counter dirCacheHits;
+    Counter dirCacheMisses;
+    Counter dirCacheEvictions;
+    LatencyHistogram requestDuration;
+    LatencyHistogram queueWait;
+    std::array<LatencyHistogram, STAGE_COUNT> stageDuration;
+    PrefixUsageTable prefixUsage;
+    HeavyHitters heavyHitters;
+    LatencyHistogram tcpRtt;   // every sample, the periodic ones too.
+    Counter tcpRetransmits;
+    Counter tcpBusyUs;
+    Counter tcpRwndLimitedUs;
+
+    void count_request(uint16_t status, uint64_t bytes, uint64_t durationUs) noexcept {
+        auto iter = std::ranges::find(METRICS_STATUSES, status);
+        requests[iter - METRICS_STATUSES.begin()].add();
+        bytesSent.add(bytes);
+        requestDuration.record(durationUs);
+    }
+
+    void count_stages(const std::array<uint64_t, STAGE_COUNT>& stageUs) noexcept {
+        for (size_t i = 0; i < STAGE_COUNT; ++i) {
+            stageDuration[i].record(stageUs[i]);
+        }
+    }
+
+    // the sample at the end of a connection, its totals are added once.
+    void count_tcp(const TcpSample& sample) noexcept {
+        tcpRtt.record(sample.rttUs);
+        tcpRetransmits.add(sample.retransmits);
+        tcpBusyUs.add(sample.busyUs);
+        tcpRwndLimitedUs.add(sample.rwndLimitedUs);
+    }
+};
+
+class Metrics {
+    std::vector<std::unique_ptr<ThreadMetrics>> threads;   // never shrinks, like the access log rings.
+    std::atomic<SOCKET> listener{ INVALID_SOCKET };
+    std::mutex mut;
+
+    ThreadMetrics* register_thread() {
+        std::unique_lock<std::mutex> lock{ mut };
+        threads.push_back(std::make_unique<ThreadMetrics>());
+        return threads.back().get();
+    }
+
+    template <class Func>
+    uint64_t sum(Func&& func) {   // called with <mut> held.
+        uint64_t total = 0;
+        for (auto& thread : threads) {
+            total += func(*thread).get();
+        }
+        return total;
+    }
+
+    static void append_seconds(OutputBuffer& out, uint64_t us) {   // without floating point, so it is exact.
+        auto fraction = us % 1000000;
+
+        out.append_number(us / 1000000);
+        out.append(".");
+        for (uint64_t digit = 100000; digit != 0; digit /= 10) {
+            out.append_number(fraction / digit % 10);
+        }
+    }
+
+    static void append_family(OutputBuffer& out, std::string_view name, std::string_view type, std::string_view help) {
+        out.append("# HELP "); out.append(name); out.append(" "); out.append(help); out.append("\n");
+        out.append("# TYPE "); out.append(name); out.append(" "); out.append(type); out.append("\n");
+    }
+
+    /*
+        prometheus histogram series in seconds, <labels> is empty or like stage="recv".
+        the same le are written on every scrape, one for each power of 2 up to HTTP_METRICS_BUCKET_MAX_US,
+        coarser than LatencyHistogram, whose bucket boundaries they fall on, so the counts are exact.
+    */
+    template <class Func>
+    void append_histogram(OutputBuffer& out, std::string_view name, std::string_view labels, Func&& histogram) {   // called with <mut> held.
+        LatencyHistogram::Snapshot snapshot{};
+        uint64_t sumUs = 0;
+        for (auto& thread : threads) {
+            histogram(*thread).merge_into(snapshot, sumUs);
+        }
+
+        auto append_series = [&](std::string_view suffix) {
+            out.append(name); out.append(suffix);
+            if (!labels.empty()) {
+                out.append("{"); out.append(labels); out.append("}");
+            }
+            out.append(" ");
+        };
+
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < snapshot.size(); ++i) {
+            cumulative += snapshot[i];
+
+            // the last bucket of each power of 2.
+            auto upper = LatencyHistogram::bucket_upper(i);
+            if (i % LatencyHistogram::SUB_BUCKETS != LatencyHistogram::SUB_BUCKETS - 1 || upper > HTTP_METRICS_BUCKET_MAX_US) {
+                continue;
+            }
+
+            out.append(name); out.append("_bucket{");
+            if (!labels.empty()) {
+                out.append(labels); out.append(",");
+            }
+            out.append("le=\"");
+            append_seconds(out, upper);
+            out.append("\"} "); out.append_number(cumulative); out.append("\n");
+        }
+
+        out.append(name); out.append("_bucket{");
+        if (!labels.empty()) {
+            out.append(labels); out.append(",");
+        }
+        out.append("le=\"+Inf\"} "); out.append_number(cumulative); out.append("\n");
+        append_series("_sum"); append_seconds(out, sumUs); out.append("\n");
+        append_series("_count"); out.append_number(cumulative); out.append("\n");
+    }
+
+    static void append_label_value(OutputBuffer& out, std::string_view value) {
+        for (char c : value) {
+            if (c == '\\' || c == '"') {
+                out.append("\\");
+                out.append({ &c, 1 });
+            }
+            else if (c == '\n') {
+                out.append("\\n");
+            }
+            else {
+                out.append({ &c, 1 });
+            }
+        }
+    }
+
+    // resources by path prefix, the tables of all the threads merged.
+    void append_prefix_usage(OutputBuffer& out) {   // called with <mut> held.
+        struct Totals {
+            uint64_t requests = 0;
+            uint64_t cpuUs = 0;
+            uint64_t minorFaults = 0;
+            uint64_t majorFaults = 0;
+            uint64_t voluntarySwitches = 0;
+        };
+
+        std::map<std::string, Totals, std::less<>> prefixes;
+        for (auto& thread : threads) {
+            thread->prefixUsage.for_each([&](const PrefixUsageTable::Slot& slot) {
+                auto iter = prefixes.find(slot.name());
+                if (iter == prefixes.end()) {
+                    iter = prefixes.emplace(slot.name(), Totals{}).first;
+                }
+
+                iter->second.requests += slot.requests.get();
+                iter->second.cpuUs += slot.cpuUs.get();
+                iter->second.minorFaults += slot.minorFaults.get();
+                iter->second.majorFaults += slot.majorFaults.get();
+                iter->second.voluntarySwitches += slot.voluntarySwitches.get();
+            });
+        }
+
+        auto append_family_series = [&](std::string_view name, std::string_view type, std::string_view help, auto&& append_value) {
+            append_family(out, name, type, help);
+            for (auto& [prefix, totals] : prefixes) {
+                out.append(name); out.append("{prefix=\""); append_label_value(out, prefix); out.append("\"} ");
+                append_value(totals);
+                out.append("\n");
+            }
+        };
+
+        append_family_series("hfs_prefix_requests_total", "counter", "Requests by the first directory of the path.",
+            [&](const Totals& t) { out.append_number(t.requests); });
+        append_family_series("hfs_prefix_cpu_seconds_total", "counter", "Thread cpu time of the requests, user and system.",
+            [&](const Totals& t) { append_seconds(out, t.cpuUs); });
+        append_family_series("hfs_prefix_minor_faults_total", "counter", "Minor page faults of the requests.",
+            [&](const Totals& t) { out.append_number(t.minorFaults); });
+        append_family_series("hfs_prefix_major_faults_total", "counter", "Major page faults of the requests.",
+            [&](const Totals& t) { out.append_number(t.majorFaults); });
+        append_family_series("hfs_prefix_voluntary_context_switches_total", "counter", "Voluntary context switches of the requests, mostly blocking on the socket or the disk.",
+            [&](const Totals& t) { out.append_number(t.voluntarySwitches); });
+    }
+
+    static void append_metric(OutputBuffer& out, std::string_view name, std::string_view type, std::string_view help, uint64_t value) {
+        append_family(out, name, type, help);
+        out.append(name); out.append(" "); out.append_number(value); out.append("\n");
+    }
+public:
+    ThreadMetrics& local() noexcept {
+        thread_local ThreadMetrics* metrics = register_thread();
+        return *metrics;
+    }
+
+    void set_listener(SOCKET sock) noexcept {
+        listener.store(sock, std::memory_order_relaxed);
+    }
+
+    /*
+        the heavy hitters of all the threads, merged by summing the counts of a key, as plain text.
+        a key may be missing from a thread that saw it too rarely, so a merged count is still an estimate.
+    */
+    void render_top(OutputBuffer& out) {
+        std::unique_lock<std::mutex> lock{ mut };
+        auto now = HeavyHitters::window_of(std::chrono::steady_clock::now());
+
+        out.append("top ");
+        out.append_number(HTTP_TOP_SHOWN);
+        out.append(" of the last windows, counts decay by half every ");
+        out.append_number(HTTP_HEAVY_WINDOW_SEC);
+        out.append("s, a count is at most <error> above the true one.\n");
+
+        auto append_top = [&](std::string_view title, const SpaceSaving HeavyHitters::* tracker, bool isClient) {
+            std::vector<SpaceSaving::Entry> entries;
+            for (auto& thread : threads) {
+                (thread->heavyHitters.*tracker).snapshot(entries, now);
+            }
+
+            std::map<std::string, std::pair<uint64_t, uint64_t>, std::less<>> merged;
+            for (auto& entry : entries) {
+                auto& [count, error] = merged[entry.key];
+                count += entry.count;
+                error += entry.error;
+            }
+
+            std::vector<std::pair<std::string_view, std::pair<uint64_t, uint64_t>>> sorted(merged.begin(), merged.end());
+            auto shown = std::min<size_t>(sorted.size(), HTTP_TOP_SHOWN);
+            std::ranges::partial_sort(sorted, sorted.begin() + shown, std::ranges::greater{}, [](const auto& item) { return item.second.first; });
+
+            out.append("\n"); out.append(title); out.append(":\n");
+            for (size_t i = 0; i < shown; ++i) {
+                auto& [key, counts] = sorted[i];
+
+                out.append("  count="); out.append_number(counts.first);
+                out.append(" error="); out.append_number(counts.second);
+                out.append(" ");
+
+                if (isClient) {
+                    char client[INET6_ADDRSTRLEN] = "-";
+                    if (key.size() > 1) {
+                        inet_ntop(static_cast<unsigned char>(key[0]), key.data() + 1, client, sizeof(client));
+                    }
+                    out.append(client);
+                }
+                else {
+                    append_escaped(out, key);   // a path is the client's, keep one entry per line.
+                }
+                out.append("\n");
+            }
+        };
+
+        append_top("paths", &HeavyHitters::paths, false);
+        append_top("directories", &HeavyHitters::dirs, false);
+        append_top("clients", &HeavyHitters::clients, true);
+    }
+
+    // prometheus text format, version 0.0.4.
+    void render(OutputBuffer& out) {
+        std::unique_lock<std::mutex> lock{ mut };
+
+        out.append("# HELP hfs_requests_total Responses sent, by status code.\n# TYPE hfs_requests_total counter\n");
+        for (size_t i = 0; i <= METRICS_STATUSES.size(); ++i) {
+            out.append("hfs_requests_total{code=\"");
+            if (i < METRICS_STATUSES.size()) {
+                out.append_number(METRICS_STATUSES[i]);
+            }
+            else {
+                out.append("other");
+            }
+            out.append("\"} ");
+            out.append_number(sum([i](ThreadMetrics& m) -> Counter& { return m.requests[i]; }));
+            out.append("\n");
+        }
+
+        append_metric(out, "hfs_response_body_bytes_total", "counter", "Body bytes sent.",
+            sum([](ThreadMetrics& m) -> Counter& { return m.bytesSent; }));
+
+        // counted apart by the acceptor and the workers, so that no counter has two writers.
+        auto accepted = sum([](ThreadMetrics& m) -> Counter& { return m.connectionsAccepted; });
+        auto closed = sum([](ThreadMetrics& m) -> Counter& { return m.connectionsClosed; });
+        append_metric(out, "hfs_connections_accepted_total", "counter", "Connections accepted.", accepted);
+        append_metric(out, "hfs_connections_active", "gauge", "Connections accepted and not closed yet.", accepted - std::min(closed, accepted));
+
+        auto queued = sum([](ThreadMetrics& m) -> Counter& { return m.tasksQueued; });
+        auto started = sum([](ThreadMetrics& m) -> Counter& { return m.tasksStarted; });
+        append_metric(out, "hfs_threadpool_queue_depth", "gauge", "Tasks waiting for a worker.", queued - std::min(started, queued));
+
+        append_metric(out, "hfs_dir_cache_hits_total", "counter", "Directory listings served from the cache.",
+            sum([](ThreadMetrics& m) -> Counter& { return m.dirCacheHits; }));
+        append_metric(out, "hfs_dir_cache_misses_total", "counter", "Directory listings collected.",
+            sum([](ThreadMetrics& m) -> Counter& { return m.dirCacheMisses; }));
+        append_metric(out, "hfs_dir_cache_evictions_total", "counter", "Directory listings evicted from the cache.",
+            sum([](ThreadMetrics& m) -> Counter& { return m.dirCacheEvictions; }));
+
+        append_metric(out, "hfs_tcp_retransmits_total", "counter", "Segments retransmitted, by the connections closed.",
+            sum([](ThreadMetrics& m) -> Counter& { return m.tcpRetransmits; }));
+        auto busyUs = sum([](ThreadMetrics& m) -> Counter& { return m.tcpBusyUs; });
+        auto rwndLimitedUs = sum([](ThreadMetrics& m) -> Counter& { return m.tcpRwndLimitedUs; });
+        append_family(out, "hfs_tcp_busy_seconds_total", "counter", "Time the connections had data to send.");
+        out.append("hfs_tcp_busy_seconds_total "); append_seconds(out, busyUs); out.append("\n");
+        append_family(out, "hfs_tcp_rwnd_limited_seconds_total", "counter", "Time the connections were held back by the receive window of the client.");
+        out.append("hfs_tcp_rwnd_limited_seconds_total "); append_seconds(out, rwndLimitedUs); out.append("\n");
+
+        if (auto queue = ListenQueue::of(listener.load(std::memory_order_relaxed)); queue.valid) {
+            append_metric(out, "hfs_listen_queue_length", "gauge", "Connections waiting for accept().", queue.length);
+            append_metric(out, "hfs_listen_queue_limit", "gauge", "Backlog of the listening socket.", queue.limit);
+            append_metric(out, "hfs_listen_overflows_total", "counter", "Accept queue overflows of all the listeners of the host.", queue.overflows);
+            append_metric(out, "hfs_listen_drops_total", "counter", "Connection requests dropped by all the listeners of the host.", queue.drops);
+        }
+
+        append_prefix_usage(out);
+
+        append_family(out, "hfs_tcp_rtt_seconds", "histogram", "Smoothed round trip time, sampled at the end of each response and periodically during long ones.");
+        append_histogram(out, "hfs_tcp_rtt_seconds", {}, [](ThreadMetrics& m) -> LatencyHistogram& { return m.tcpRtt; });
+
+        append_family(out, "hfs_request_duration_seconds", "histogram", "Time from the start of a connection task to the end of the response.");
+        append_histogram(out, "hfs_request_duration_seconds", {}, [](ThreadMetrics& m) -> LatencyHistogram& { return m.requestDuration; });
+
+        append_family(out, "hfs_threadpool_wait_seconds", "histogram", "Time a task waits in the queue for a worker.");
+        append_histogram(out, "hfs_threadpool_wait_seconds", {}, [](ThreadMetrics& m) -> LatencyHistogram& { return m.queueWait; });
+
+        append_family(out, "hfs_request_stage_seconds", "histogram", "Time spent in each stage of a request, from the accept.");
+        for (size_t i = 0; i < STAGE_COUNT; ++i) {
+            auto labels = std::format("stage=\"{}\"", STAGE_NAMES[i]);
+            append_histogram(out, "hfs_request_stage_seconds", labels, [i](ThreadMetrics& m) -> LatencyHistogram& { return m.stageDuration[i]; });
+        }
+    }
+};
+
+static Metrics metrics;
+
+/*
+    request tracing, off by default, switched at runtime through HTTP_TRACE_URI.
+    when off, a request only loads a flag. when on, every request copies one TraceRecord into a ring owned by
+    its thread, the oldest records are overwritten, so memory stays bounded by HTTP_TRACE_RING_LEN records per
+    thread. a dump renders the rings as Chrome Trace Event JSON, viewable in Perfetto or chrome://tracing:
+    the accept and the queue wait are on the acceptor track, each worker has its own track with a span per
+    request and a child span per stage.
+*/
+struct TraceRecord {
+    uint64_t id;
+    std::chrono::steady_clock::time_point accepted;
+    std::array<std::chrono::steady_clock::time_point, STAGE_COUNT> stageEnds;
+    uint64_t bytes;
+    uint16_t status;
+    uint16_t pathLen;
+    std::array<char, HTTP_LOG_PATH_LEN> path;
+};
+
+class TraceRing {
+    std::vector<TraceRecord> records;   // allocated by the first record, a thread that never traces costs nothing.
+    uint64_t head = 0;
+    std::mutex mut;   // only contended while dumping.
+public:
+    void push(const TraceRecord& record) {
+        std::unique_lock<std::mutex> lock{ mut };
+
+        if (records.empty()) {
+            records.resize(HTTP_TRACE_RING_LEN);
+        }
+        records[head++ % records.size()] = record;
+    }
+
+    void clear() {
+        std::unique_lock<std::mutex> lock{ mut };
+        head = 0;
+    }
+
+    template <class Func>
+    void for_each(Func&& func) {
+        std::unique_lock<std::mutex> lock{ mut };
+
+        auto count = std::min<uint64_t>(head, records.size());
+        for (auto i = head - count; i != head; ++i) {
+            func(records[i % records.size()]);
+        }
+    }
+};
+
+class Tracer {
+    std::vector<std::unique_ptr<TraceRing>> rings;   // never shrinks, the index is the track of the thread.
+    std::atomic<bool> on{ false };
+    std::atomic<uint64_t> nextId{ 0 };
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::mutex mut;
+
+    TraceRing* register_ring() {
+        std::unique_lock<std::mutex> lock{ mut };
+        rings.push_back(std::make_unique<TraceRing>());
+        return rings.back().get();
+    }
+
+    uint64_t us_since_epoch(std::chrono::steady_clock::time_point t) const noexcept {
+        return std::chrono::duration_cast<std::chrono::microseconds>(t - epoch).count();
+    }
+
+    static void append_json_string(OutputBuffer& out, std::string_view str) {
+        out.append("\"");
+        for (char c : str) {
+            if (c == '"' || c == '\\') {
+                out.append("\\");
+                out.append({ &c, 1 });
+            }
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                constexpr std::string_view HEX = "0123456789abcdef";
+                char escaped[] = { '\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xf] };
+                out.append({ escaped, sizeof(escaped) });
+            }
+            else {
+                out.append({ &c, 1 });
+            }
+        }
+        out.append("\"");
+    }
+
+    void append_event(OutputBuffer& out, std::string_view name, std::string_view phase, uint64_t ts, size_t tid) {
+        out.append(",\n{\"name\":\""); out.append(name);
+        out.append("\",\"ph\":\""); out.append(phase);
+        out.append("\",\"pid\":1,\"tid\":"); out.append_number(tid);
+        out.append(",\"ts\":"); out.append_number(ts);
+    }
+
+    void append_record(OutputBuffer& out, const TraceRecord& record, size_t tid) {
+        auto accepted = us_since_epoch(record.accepted);
+        auto started = us_since_epoch(record.stageEnds[STAGE_QUEUE]);
+        auto finished = us_since_epoch(record.stageEnds[STAGE_COUNT - 1]);
+
+        append_event(out, "accept", "i", accepted, 0);
+        out.append(",\"s\":\"t\"}");
+
+        // queue waits overlap each other, as async events they get their own rows.
+        append_event(out, "queue", "b", accepted, 0);
+        out.append(",\"cat\":\"request\",\"id\":"); out.append_number(record.id); out.append("}");
+        append_event(out, "queue", "e", started, 0);
+        out.append(",\"cat\":\"request\",\"id\":"); out.append_number(record.id); out.append("}");
+
+        append_event(out, "request", "X", started, tid);
+        out.append(",\"dur\":"); out.append_number(finished - started);
+        out.append(",\"args\":{\"id\":"); out.append_number(record.id);
+        out.append(",\"path\":"); append_json_string(out, { record.path.data(), record.pathLen });
+        out.append(",\"status\":"); out.append_number(record.status);
+        out.append(",\"bytes\":"); out.append_number(record.bytes);
+        out.append("}}");
+
+        auto prev = started;
+        for (size_t i = STAGE_QUEUE + 1; i < STAGE_COUNT; ++i) {
+            auto end = us_since_epoch(record.stageEnds[i]);
+            append_event(out, STAGE_NAMES[i], "X", prev, tid);
+            out.append(",\"dur\":"); out.append_number(end - prev); out.append("}");
+            prev = end;
+        }
+    }
+
+    void append_thread_name(OutputBuffer& out, size_t tid, std::string_view name) {
+        out.append(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"); out.append_number(tid);
+        out.append(",\"args\":{\"name\":\""); out.append(name); out.append("\"}}");
+    }
+public:
+    bool enabled() const noexcept {
+        return on.load(std::memory_order_relaxed);
+    }
+
+    // switching on starts a new trace, the records of the last one are dropped.
+    void enable(bool enable) {
+        if (enable && !enabled()) {
+            std::unique_lock<std::mutex> lock{ mut };
+            for (auto& ring : rings) {
+                ring->clear();
+            }
+        }
+
+        on.store(enable, std::memory_order_relaxed);
+    }
+
+    uint64_t next_id() noexcept {
+        return nextId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record(const TraceRecord& record) {
+        thread_local TraceRing* ring = register_ring();
+        ring->push(record);
+    }
+
+    void render(OutputBuffer& out) {
+        std::unique_lock<std::mutex> lock{ mut };
+
+        out.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        out.append("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"HttpFileServer\"}}");
+        append_thread_name(out, 0, "acceptor");
+
+        for (size_t i = 0; i < rings.size(); ++i) {
+            auto tid = i + 1;
+
+            append_thread_name(out, tid, std::format("worker {}", tid));
+            rings[i]->for_each([&](const TraceRecord& record) { append_record(out, record, tid); });
+        }
+
+        out.append("\n]}\n");
+    }
+};
+
+static Tracer tracer;
+
+/*
+    live connections, for HTTP_CONNECTIONS_URI.
+    a worker serves one connection at a time, so each worker owns one ConnectionSlot and describes its current
+    connection there: a few relaxed stores per state change, and the bytes after each send().
+    the peer and the path are written under a sequence number, like SpaceSaving keys, so a reader copies them
+    whole. nothing points at the connection itself, a listing never races with its destruction.
+*/
+enum ConnectionState : uint8_t {
+    CONNECTION_IDLE,
+    CONNECTION_READING,
+    CONNECTION_PROCESSING,
+    CONNECTION_SENDING
+};
+
+constexpr std::array<std::string_view, 4> CONNECTION_STATE_NAMES{ "idle", "reading", "processing", "sending" };
+
+class ConnectionSlot {
+public:
+    static constexpr size_t PATH_LEN = 128;
+
+    struct Snapshot {
+        ConnectionState state;
+        uint64_t id;
+        std::chrono::steady_clock::time_point accepted;
+        uint64_t bytes;
+        TcpSample tcp;
+        int family;
+        std::array<uint8_t, 16> addr;
+        std::string path;
+    };
+private:
+    static constexpr size_t PATH_WORDS = PATH_LEN / sizeof(uint64_t);
+
+    std::atomic<uint32_t> seq{ 0 };
+    std::atomic<uint64_t> id{ 0 };
+    std::atomic<std::chrono::steady_clock::rep> accepted{ 0 };
+    std::atomic<int> family{ 0 };
+    std::array<std::atomic<uint64_t>, 2> addr{};
+    std::atomic<uint32_t> pathLen{ 0 };
+    std::array<std::atomic<uint64_t>, PATH_WORDS> path{};
+    std::atomic<ConnectionState> state{ CONNECTION_IDLE };
+    std::atomic<uint64_t> bytes{ 0 };
+    std::atomic<uint32_t> tcpRttUs{ 0 };   // from the last sample, 0 before the first one.
+    std::atomic<uint32_t> tcpCwnd{ 0 };
+    std::atomic<uint32_t> tcpRetransmits{ 0 };
+    std::atomic<uint64_t> tcpDeliveryRate{ 0 };
+
+    template <class Func>
+    void write_locked(Func&& func) noexcept {
+        auto s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        func();
+        seq.store(s + 2, std::memory_order_release);
+    }
+public:
+    void begin(uint64_t _id, std::chrono::steady_clock::time_point _accepted, const sockaddr_storage& client) noexcept {
+        std::array<uint64_t, 2> words{};
+        auto f = static_cast<int>(client.ss_family);
+        if (f == AF_INET) {
+            std::memcpy(words.data(), &reinterpret_cast<const sockaddr_in&>(client).sin_addr, 4);
+        }
+        else if (f == AF_INET6) {
+            std::memcpy(words.data(), &reinterpret_cast<const sockaddr_in6&>(client).sin6_addr, 16);
+        }
+        else {
+            f = 0;
+        }
+
+        write_locked([&]() {
+            id.store(_id, std::memory_order_relaxed);
+            accepted.store(_accepted.time_since_epoch().count(), std::memory_order_relaxed);
+            family.store(f, std::memory_order_relaxed);
+            addr[0].store(words[0], std::memory_order_relaxed);
+            addr[1].store(words[1], std::memory_order_relaxed);
+            pathLen.store(0, std::memory_order_relaxed);
+        });
+
+        bytes.store(0, std::memory_order_relaxed);
+        tcpRttUs.store(0, std::memory_order_relaxed);
+        state.store(CONNECTION_READING, std::memory_order_relaxed);
+    }
+
+    void set_path(std::string_view _path) noexcept {
+        std::array<uint64_t, PATH_WORDS> words{};
+        _path = { _path.data(), std::min(_path.size(), PATH_LEN) };
+        std::memcpy(words.data(), _path.data(), _path.size());
+
+        write_locked([&]() {
+            for (size_t i = 0; i < PATH_WORDS; ++i) {
+                path[i].store(words[i], std::memory_order_relaxed);
+            }
+            pathLen.store(static_cast<uint32_t>(_path.size()), std::memory_order_relaxed);
+        });
+    }
+
+    void set_state(ConnectionState _state) noexcept {
+        state.store(_state, std::memory_order_relaxed);
+    }
+
+    void add_bytes(uint64_t n) noexcept {   // single writer.
+        bytes.store(bytes.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void set_tcp(const TcpSample& sample) noexcept {   // each field is whole, they may be from two samples.
+        tcpCwnd.store(sample.cwnd, std::memory_order_relaxed);
+        tcpRetransmits.store(sample.retransmits, std::memory_order_relaxed);
+        tcpDeliveryRate.store(sample.deliveryRate, std::memory_order_relaxed);
+        tcpRttUs.store(sample.rttUs, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const {
+        Snapshot snap;
+        std::array<uint64_t, PATH_WORDS> words;
+        std::array<uint64_t, 2> addrWords;
+        uint32_t len;
+        uint32_t s;
+
+        do {
+            s = seq.load(std::memory_order_acquire);
+            snap.id = id.load(std::memory_order_relaxed);
+            snap.accepted = std::chrono::steady_clock::time_point{ std::chrono::steady_clock::duration{ accepted.load(std::memory_order_relaxed) } };
+            snap.family = family.load(std::memory_order_relaxed);
+            addrWords[0] = addr[0].load(std::memory_order_relaxed);
+            addrWords[1] = addr[1].load(std::memory_order_relaxed);
+            len = std::min<uint32_t>(pathLen.load(std::memory_order_relaxed), PATH_LEN);
+            for (size_t i = 0; i < PATH_WORDS; ++i) {
+                words[i] = path[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((s & 1) != 0 || s != seq.load(std::memory_order_relaxed));
+
+        std::memcpy(snap.addr.data(), addrWords.data(), snap.addr.size());
+        snap.path.assign(reinterpret_cast<const char*>(words.data()), len);
+        snap.state = state.load(std::memory_order_relaxed);
+        snap.bytes = bytes.load(std::memory_order_relaxed);
+        snap.tcp.rttUs = tcpRttUs.load(std::memory_order_relaxed);
+        snap.tcp.cwnd = tcpCwnd.load(std::memory_order_relaxed);
+        snap.tcp.retransmits = tcpRetransmits.load(std::memory_order_relaxed);
+        snap.tcp.deliveryRate = tcpDeliveryRate.load(std::memory_order_relaxed);
+        return snap;
+    }
+};
+
+class ConnectionRegistry {
+    std::vector<std::unique_ptr<ConnectionSlot>> slots;   // never shrinks, the index is the worker number.
+    std::mutex mut;
+
+    ConnectionSlot* register_slot() {
+        std::unique_lock<std::mutex> lock{ mut };
+        slots.push_back(std::make_unique<ConnectionSlot>());
+        return slots.back().get();
+    }
+public:
+    ConnectionSlot& local() {
+        thread_local ConnectionSlot* slot = register_slot();
+        return *slot;
+    }
+
+    // one line per worker that has served a connection, like the access log.
+    void render(OutputBuffer& out) {
+        std::unique_lock<std::mutex> lock{ mut };
+        auto now = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < slots.size(); ++i) {
+            auto snap = slots[i]->snapshot();
+
+            out.append("worker="); out.append_number(i + 1);
+            out.append(" state="); out.append(CONNECTION_STATE_NAMES[snap.state]);
+
+            if (snap.state != CONNECTION_IDLE) {
+                char peer[INET6_ADDRSTRLEN] = "-";
+                if (snap.family != 0) {
+                    inet_ntop(snap.family, snap.addr.data(), peer, sizeof(peer));
+                }
+
+                out.append(" id="); out.append_number(snap.id);
+                out.append(" peer="); out.append(peer);
+                out.append(" elapsed_us="); out.append_number(std::chrono::duration_cast<std::chrono::microseconds>(now - snap.accepted).count());
+                out.append(" bytes="); out.append_number(snap.bytes);
+                if (snap.tcp.rttUs != 0) {   // sampled during a long response.
+                    out.append(" rtt_us="); out.append_number(snap.tcp.rttUs);
+                    out.append(" cwnd="); out.append_number(snap.tcp.cwnd);
+                    out.append(" retrans="); out.append_number(snap.tcp.retransmits);
+                    out.append(" delivery_rate="); out.append_number(snap.tcp.deliveryRate);
+                }
+                out.append(" path=\"");
+                for (char c : snap.path) {   // keep one connection per line.
+                    if (c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20) {
+                        c = '?';
+                    }
+                    out.append({ &c, 1 });
+                }
+                out.append("\"");
+            }
+            out.append("\n");
+        }
+    }
+};
+
+static ConnectionRegistry connectionRegistry;
+
+/*
+    entries of a directory.
+    every name is encoded to UTF-8 and escaped once when it is added, its url form and html form live in two
+    arenas (only the url one when the name has nothing to escape), so collecting a directory doesn't allocate
+    per entry, and rendering a page from it is copying pieces of the arenas.
+    the entries keep the directory order and nothing about the page, so any page format could be rendered from them.
+    once collected, a listing is never changed, and is shared between threads through DirListingCache.
+*/
+class DirListing {
+    struct Entry {
+        size_t urlOffset;
+        size_t urlLen;
+        size_t htmlOffset;
+        size_t htmlLen;
+        bool htmlEscaped;   // otherwise the html form is the url form.
+        bool isDir;
+        uintmax_t size;
+    };
+
+    OutputBuffer urls;
+    OutputBuffer htmls;
+    std::vector<Entry> entries;
+public:
+    void collect(const fs::path& dir) {
+        thread_local std::string nameScratch;
+
+        for (const auto& entry : fs::directory_iterator(dir, fs::directory_options::skip_permission_denied)) {
+            /*
+            * It is necessary to use Unicode to process paths on the Windows platform,
+            * while for HTML pages, we use UTF-8. on POSIX the names are used as they are.
+            */
+            bool isDir = entry.is_directory();
+            add(path_to_utf8(filename_view(entry.path()), nameScratch), isDir, isDir ? 0 : entry.file_size());
+        }
+    }
+
+    void add(std::string_view name, bool isDir, uintmax_t size) {
+        auto urlOffset = urls.size();
+
+        if (escape_clean_prefix(name) == name.size()) {   // the usual case, both forms are the name itself, stored once.
+            urls.append(name);
+            entries.push_back({ urlOffset, name.size(), urlOffset, name.size(), false, isDir, size });
+            return;
+        }
+
+        auto htmlOffset = htmls.size();
+        escape_name(name, &urls, htmls);
+        entries.push_back({ urlOffset, urls.size() - urlOffset, htmlOffset, htmls.size() - htmlOffset, true, isDir, size });
+    }
+
+    // upper bound of the rendered page, so the output buffer grows once at most.
+    size_t estimate_size(std::string_view dirName) const noexcept {
+        auto size = LISTING_HEAD_TEMPLATE.fixed_size() + dirName.size() * ESCAPE_HTML_MAX_RATIO + LISTING_TAIL_TEMPLATE.fixed_size();
+        auto entrySize = std::max(LISTING_DIR_TEMPLATE.fixed_size(), LISTING_FILE_TEMPLATE.fixed_size() + FILE_SIZE_MAX_LEN);
+        return size + entries.size() * entrySize + urls.size() + htmls.size();
+    }
+
+    void render(OutputBuffer& out, std::string_view dirName) const {
+        out.reserve(out.size() + estimate_size(dirName));
+
+        LISTING_HEAD_TEMPLATE.render(out, HtmlEscapedField{ dirName });
+
+        for (const auto& entry : entries) {
+            std::string_view url{ urls.view().data() + entry.urlOffset, entry.urlLen };
+            std::string_view html{ (entry.htmlEscaped ? htmls : urls).view().data() + entry.htmlOffset, entry.htmlLen };
+
+            if (entry.isDir) {
+                LISTING_DIR_TEMPLATE.render(out, url, html);
+            }
+            else {
+                LISTING_FILE_TEMPLATE.render(out, url, html, FileSizeField{ entry.size });
+            }
+        }
+
+        LISTING_TAIL_TEMPLATE.render(out);
+    }
+};
+
+/*
+    cache of the listings of recently served directories.
+    a listing is reused while the directory's last write time is unchanged, which changes when entries are added,
+    removed or renamed. it doesn't change when a file inside grows, so a listing is also rebuilt once it is
+    HTTP_DIR_CACHE_MAX_AGE_SEC old, to keep the sizes fresh.
+    readers share the lock, and a listing is built outside of it, two threads may build the same directory at the
+    same time, the later one just replaces the other.
+*/
+class DirListingCache {
+    struct Item {
+        std::shared_ptr<const DirListing> listing;
+        fs::file_time_type writeTime;
+        std::chrono::steady_clock::time_point built;
+    };
+
+    std::unordered_map<native_string, Item> items;
+    std::shared_mutex mut;
+
+    void evict_oldest() {
+        auto oldest = std::ranges::min_element(items, {}, [](const auto& item) { return item.second.built; });
+        items.erase(oldest);
+    }
+public:
+    std::shared_ptr<const DirListing> get(const fs::path& dir) {
+        std::error_code ec;
+        auto writeTime = fs::last_write_time(dir, ec);
+        auto now = std::chrono::steady_clock::now();
+
+        if (!ec) {
+            std::shared_lock<std::shared_mutex> lock{ mut };
+
+            auto iter = items.find(dir.native());
+            if (iter != items.end() && iter->second.writeTime == writeTime && now - iter->second.built < std::chrono::seconds(HTTP_DIR_CACHE_MAX_AGE_SEC)) {
+                metrics.local().dirCacheHits.add();
+                HFS_PROBE1(cache_hit, dir.c_str());
+                return iter->second.listing;
+            }
+        }
+
+        metrics.local().dirCacheMisses.add();
+        HFS_PROBE1(cache_miss, dir.c_str());
+
+        auto listing = std::make_shared<DirListing>();
+        listing->collect(dir);
+
+        if (!ec) {   // without the write time, it couldn't be validated later.
+            std::unique_lock<std::shared_mutex> lock{ mut };
+
+            if (items.size() >= HTTP_DIR_CACHE_CAPACITY && !items.contains(dir.native())) {
+                evict_oldest();
+                metrics.local().dirCacheEvictions.add();
+            }
+            items.insert_or_assign(dir.native(), Item{ listing, writeTime, now });
+        }
+
+        return listing;
+    }
+
+    size_t size() {
+        std::shared_lock<std::shared_mutex> lock{ mut };
+        return items.size();
+    }
+};
+
+static DirListingCache dirListingCache;
+
+/*
+    Thread pool.
+    This thread pool ignores the return value, so you have to push some functions like: void my_func(void);
+    Drawing inspiration from Jakob Progsch and yhirose's thread pool implementation.
+*/
+class ThreadPool {
+    struct Task {
+        std::function<void()> func;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    bool running;
+    std::queue<Task> taskQueue;
+    std::vector<std::thread> workers;
+    std::mutex mut;
+    std::condition_variable cv;
+public:
+    explicit ThreadPool(size_t numOfWorkers)
+        : running{ true }
+    {
+        for (size_t i = 0; i < numOfWorkers; ++i) {
+            workers.emplace_back([this]() {
+                while (true) {
+                    Task task;
+
+                    {
+                        std::unique_lock<std::mutex> lock{ mut };
+                        cv.wait(lock, [this]() { return !running || !taskQueue.empty(); });
+
+                        if (!running && taskQueue.empty()) {
+                            return;
+                        }
+
+                        task = std::move(taskQueue.front());
+                        taskQueue.pop();
+                    }
+
+                    auto waitUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - task.queued).count());
+                    auto& local = metrics.local();
+                    local.tasksStarted.add();
+                    local.queueWait.record(waitUs);
+                    HFS_PROBE1(task_dequeue, waitUs);
+
+                    task.func();
+                }
+                });
+        }
+    }
+
+    ThreadPool() : ThreadPool{ std::thread::hardware_concurrency() } {}
+
+    ~ThreadPool() noexcept {
+        {
+            /* first set running to false. */
+            std::unique_lock<std::mutex> lock{ mut };
+            running = false;
+        }
+
+        cv.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void add_task(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock{ mut };
+            taskQueue.push({ std::move(task), std::chrono::steady_clock::now() });
+            metrics.local().tasksQueued.add();
+        }
+
+        cv.notify_one();
+    }
+};
+
+/*
+    cached Date header.
+    the value only changes once per second, so instead of formatting the time for every response,
+    a timer thread refreshes a preformatted line every second and publishes it through an atomic index.
+    like nginx's cached time, there are several slots and the timer always fills the one after the published one,
+    a reader copying the line would have to stall for seconds before that slot is written again.
+*/
+class HttpDateCache {
+    static constexpr size_t SLOTS = 4;
+    static constexpr size_t LINE_LEN = sizeof("Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n") - 1;
+
+    std::array<std::array<char, LINE_LEN>, SLOTS> slots;
+    std::atomic<size_t> current;
+    bool running;
+    std::mutex mut;
+    std::condition_variable cv;
+    std::thread timer;
+
+    static void format_date(std::array<char, LINE_LEN>& line, std::chrono::system_clock::time_point now) {   // RFC 7231 IMF-fixdate.
+        static constexpr std::array<std::string_view, 7> WEEKDAYS{ "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+        static constexpr std::array<std::string_view, 12> MONTHS{ "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+        auto days = std::chrono::floor<std::chrono::days>(now);
+        std::chrono::year_month_day ymd{ days };
+        std::chrono::hh_mm_ss hms{ std::chrono::floor<std::chrono::seconds>(now - days) };
+
+        auto put = [&line, pos = size_t{ 0 }](std::string_view str) mutable {
+            std::copy(str.begin(), str.end(), line.begin() + pos);
+            pos += str.size();
+        };
+        auto two_digits = [](unsigned value) {
+            return std::array<char, 2>{ static_cast<char>('0' + value / 10 % 10), static_cast<char>('0' + value % 10) };
+        };
+
+        auto day = two_digits(static_cast<unsigned>(ymd.day()));
+        auto year = static_cast<unsigned>(static_cast<int>(ymd.year()));
+        auto yearHigh = two_digits(year / 100);
+        auto yearLow = two_digits(year);
+        auto hour = two_digits(static_cast<unsigned>(hms.hours().count()));
+        auto minute = two_digits(static_cast<unsigned>(hms.minutes().count()));
+        auto second = two_digits(static_cast<unsigned>(hms.seconds().count()));
+
+        put("Date: ");
+        put(WEEKDAYS[std::chrono::weekday{ days }.c_encoding()]);
+        put(", ");
+        put({ day.data(), 2 });
+        put(" ");
+        put(MONTHS[static_cast<unsigned>(ymd.month()) - 1]);
+        put(" ");
+        put({ yearHigh.data(), 2 });
+        put({ yearLow.data(), 2 });
+        put(" ");
+        put({ hour.data(), 2 });
+        put(":");
+        put({ minute.data(), 2 });
+        put(":");
+        put({ second.data(), 2 });
+        put(" GMT\r\n");
+    }
+
+    void refresh() {
+        auto next = (current.load(std::memory_order_relaxed) + 1) % SLOTS;
+        format_date(slots[next], std::chrono::system_clock::now());
+        current.store(next, std::memory_order_release);
+    }
+public:
+    HttpDateCache()
+        : current{ 0 }, running{ true }
+    {
+        format_date(slots[0], std::chrono::system_clock::now());
+
+        timer = std::thread([this]() {
+            std::unique_lock<std::mutex> lock{ mut };
+
+            while (!cv.wait_for(lock, std::chrono::seconds(1), [this]() { return !running; })) {
+                refresh();
+            }
+        });
+    }
+
+    ~HttpDateCache() noexcept {
+        {
+            std::unique_lock<std::mutex> lock{ mut };
+            running = false;
+        }
+
+        cv.notify_all();
+        timer.join();
+    }
+
+    std::string_view line() const noexcept {
+        const auto& slot = slots[current.load(std::memory_order_acquire)];
+        return { slot.data(), slot.size() };
+    }
+};
+
+static HttpDateCache httpDate;
+
+#ifdef _WIN32
+/*
+    on windows platform, before you could use socket,
+    you have to use WSAStartup() and finally use WSACleanup(),
+    so this RAII class is needed.
+*/
+class WSASetup {
+public:
+    WSASetup() {
+        WSADATA wsaData;
+
+        WORD wVersionRequested = MAKEWORD(2, 2);
+        if (WSAStartup(wVersionRequested, &wsaData) != 0) {
+            throw_last_sys_error("WSAStartup() failed");
+        }
+    }
+
+    ~WSASetup() noexcept {
+        WSACleanup();
+    }
+};
+
+static WSASetup wsaSetup;
+#endif
+
+/*
+    access log.
+    the request path only copies a fixed-size record into a ring owned by its thread, a background flusher
+    drains all the rings, formats the lines and writes them in batches, so a request never formats, transcodes,
+    takes the stream lock or waits for the console.
+    each ring has a single producer (its thread) and a single consumer (the flusher), so head and tail are all
+    the synchronization needed. when a ring is 3/4 full, only one of HTTP_LOG_SAMPLE_UNDER_LOAD records is kept,
+    when it is full, records are dropped, both are counted and reported by the flusher.
+*/
+struct AccessRecord {
+    int64_t timeUs;   // system clock, since epoch.
+    uint64_t durationUs;
+    uint64_t bytes;   // body bytes sent.
+    uint64_t cpuUs;
+    uint32_t minorFaults;
+    uint32_t majorFaults;
+    uint32_t voluntarySwitches;
+    uint32_t tcpRttUs;
+    uint32_t tcpCwnd;
+    uint32_t tcpRetransmits;
+    uint64_t tcpDeliveryRate;
+    uint64_t tcpBusyUs;
+    uint64_t tcpRwndLimitedUs;
+    uint16_t status;
+    int family;   // AF_INET, AF_INET6, or 0 if the client is unknown.
+    std::array<uint8_t, 16> addr;
+    uint8_t methodLen;
+    std::array<char, 8> method;
+    uint16_t pathLen;
+    std::array<char, HTTP_LOG_PATH_LEN> path;
+
+    void set_client(const sockaddr_storage& client) noexcept {
+        family = client.ss_family;
+        if (family == AF_INET) {
+            std::memcpy(addr.data(), &reinterpret_cast<const sockaddr_in&>(client).sin_addr, 4);
+        }
+        else if (family == AF_INET6) {
+            std::memcpy(addr.data(), &reinterpret_cast<const sockaddr_in6&>(client).sin6_addr, 16);
+        }
+        else {
+            family = 0;
+        }
+    }
+
+    void set_usage(const ResourceUsage& usage) noexcept {
+        cpuUs = usage.cpuUs;
+        minorFaults = static_cast<uint32_t>(usage.minorFaults);
+        majorFaults = static_cast<uint32_t>(usage.majorFaults);
+        voluntarySwitches = static_cast<uint32_t>(usage.voluntarySwitches);
+    }
+
+    void set_tcp(const TcpSample& sample) noexcept {
+        tcpRttUs = sample.rttUs;
+        tcpCwnd = sample.cwnd;
+        tcpRetransmits = sample.retransmits;
+        tcpDeliveryRate = sample.deliveryRate;
+        tcpBusyUs = sample.busyUs;
+        tcpRwndLimitedUs = sample.rwndLimitedUs;
+    }
+
+    void set_request(std::string_view _method, std::string_view _path) noexcept {
+        methodLen = static_cast<uint8_t>(std::min(_method.size(), method.size()));
+        std::copy_n(_method.data(), methodLen, method.data());
+        pathLen = static_cast<uint16_t>(std::min(_path.size(), path.size()));
+        std::copy_n(_path.data(), pathLen, path.data());
+    }
+};
+
+class AccessLogRing {
+    std::array<AccessRecord, HTTP_LOG_RING_LEN> records;
+    alignas(64) std::atomic<uint64_t> head{ 0 };   // written by the producer.
+    alignas(64) std::atomic<uint64_t> tail{ 0 };   // written by the flusher.
+    std::atomic<uint64_t> dropped{ 0 };
+    std::atomic<uint64_t> sampledOut{ 0 };
+    uint64_t underLoad = 0;
+public:
+    void push(const AccessRecord& record) noexcept {
+        auto h = head.load(std::memory_order_relaxed);
+        auto used = h - tail.load(std::memory_order_acquire);
+
+        if (used >= records.size()) {
+            dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        if (used >= records.size() / 4 * 3 && ++underLoad % HTTP_LOG_SAMPLE_UNDER_LOAD != 0) {
+            sampledOut.store(sampledOut.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        records[h % records.size()] = record;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    template <class Func>
+    void drain(Func&& func) {
+        auto t = tail.load(std::memory_order_relaxed);
+        auto h = head.load(std::memory_order_acquire);
+
+        for (; t != h; ++t) {
+            func(records[t % records.size()]);
+        }
+
+        tail.store(t, std::memory_order_release);
+    }
+
+    uint64_t dropped_count() const noexcept {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    uint64_t sampled_out_count() const noexcept {
+        return sampledOut.load(std::memory_order_relaxed);
+    }
+};
+
+/*
+    memory mapped segment of the binary access log.
+    the file is created with its full size and mapped, entries are written with plain stores, and when the segment
+    is closed, the file is cut to the bytes used. a segment left by a crash keeps its zero tail, which reads as
+    BINLOG_ENTRY_END.
+*/
+class MappedSegment {
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+    uint8_t* data = nullptr;
+    size_t cap;
+    size_t len = 0;
+public:
+    MappedSegment(const fs::path& p, size_t size)
+        : cap{ size }
+    {
+#ifdef _WIN32
+        file = CreateFileW(p.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw_last_sys_error("error CreateFileW() on binary log segment");
+        }
+
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(uint64_t{ size } >> 32), static_cast<DWORD>(size), nullptr);
+        if (mapping == nullptr) {
+            auto ec = get_last_sys_ec();
+            CloseHandle(file);
+            throw std::system_error{ ec, "error CreateFileMappingW() on binary log segment" };
+        }
+
+        data = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size));
+        if (data == nullptr) {
+            auto ec = get_last_sys_ec();
+            CloseHandle(mapping);
+            CloseHandle(file);
+            throw std::system_error{ ec, "error MapViewOfFile() on binary log segment" };
+        }
+#else
+        fd = open(p.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw_last_sys_error("error open() on binary log segment");
+        }
+
+        void* addr = MAP_FAILED;
+        if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+            addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+
+        if (addr == MAP_FAILED) {
+            auto ec = get_last_sys_ec();
+            close(fd);
+            throw std::system_error{ ec, "error mapping binary log segment" };
+        }
+
+        data = static_cast<uint8_t*>(addr);
+#endif
+    }
+
+    MappedSegment(const MappedSegment&) = delete;
+    MappedSegment& operator=(const MappedSegment&) = delete;
+
+    ~MappedSegment() noexcept {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+
+        LARGE_INTEGER end;
+        end.QuadPart = static_cast<LONGLONG>(len);
+        if (!SetFilePointerEx(file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+            print_last_sys_error("error cutting binary log segment");
+        }
+        CloseHandle(file);
+#else
+        munmap(data, cap);
+
+        if (ftruncate(fd, static_cast<off_t>(len)) != 0) {
+            print_last_sys_error("error cutting binary log segment");
+        }
+        close(fd);
+#endif
+    }
+
+    bool fits(size_t n) const noexcept {
+        return cap - len >= n;
+    }
+
+    uint8_t* tail() noexcept {
+        return data + len;
+    }
+
+    void advance(size_t n) noexcept {
+        len += n;
+    }
+};
+
+/*
+    binary access log, an optional sink of AccessLogger, used only by the flusher thread.
+    methods and paths are interned per segment, so a hot path costs a few bytes for its id, and a segment
+    could be decoded on its own. segments rotate when full, the oldest ones beyond HTTP_BINLOG_KEEP_SEGMENTS
+    are deleted. see BinaryAccessLog.h for the format.
+*/
+class BinaryLogWriter {
+    struct StringHash {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view str) const noexcept {
+            return std::hash<std::string_view>{}(str);
+        }
+    };
+
+    // the largest string entry and record entry, to know whether they still fit in the segment.
+    static constexpr size_t STRING_ENTRY_MAX_LEN = 1 + 2 * BINLOG_VARINT_MAX_LEN + HTTP_LOG_PATH_LEN;
+    static constexpr size_t RECORD_ENTRY_MAX_LEN = 1 + 16 * BINLOG_VARINT_MAX_LEN + 1 + 16;
+
+    fs::path dir;
+    uint64_t sequence = 0;
+    std::unique_ptr<MappedSegment> segment;
+    std::unordered_map<std::string, uint64_t, StringHash, std::equal_to<>> strings;
+    int64_t lastTimeUs = 0;
+
+    fs::path segment_path(uint64_t seq) const {
+        return dir / std::format("access-{:08}.hfslog", seq);
+    }
+
+    void open_segment(int64_t nowUs) {
+        segment.reset();
+        strings.clear();
+
+        segment = std::make_unique<MappedSegment>(segment_path(++sequence), HTTP_BINLOG_SEGMENT_LEN);
+        std::copy(BINLOG_MAGIC.begin(), BINLOG_MAGIC.end(), segment->tail());
+        binlog_put_u64le(segment->tail() + BINLOG_MAGIC.size(), static_cast<uint64_t>(nowUs));
+        segment->advance(BINLOG_HEADER_LEN);
+        lastTimeUs = nowUs;
+
+        if (sequence > HTTP_BINLOG_KEEP_SEGMENTS) {
+            std::error_code ec;
+            fs::remove(segment_path(sequence - HTTP_BINLOG_KEEP_SEGMENTS), ec);
+        }
+    }
+
+    void put_varint(uint64_t value) {
+        segment->advance(binlog_put_varint(segment->tail(), value));
+    }
+
+    uint64_t intern(std::string_view str) {
+        auto iter = strings.find(str);
+        if (iter != strings.end()) {
+            return iter->second;
+        }
+
+        auto id = static_cast<uint64_t>(strings.size());
+        strings.emplace(str, id);
+
+        put_varint(BINLOG_ENTRY_STRING);
+        put_varint(id);
+        put_varint(str.size());
+        std::copy(str.begin(), str.end(), segment->tail());
+        segment->advance(str.size());
+
+        return id;
+    }
+public:
+    explicit BinaryLogWriter(const fs::path& _dir)
+        : dir{ _dir }
+    {
+        fs::create_directories(dir);
+
+        // continue after the segments of the last run.
+        for (const auto& entry : fs::directory_iterator(dir)) {
+            auto name = entry.path().filename().string();
+            uint64_t seq = 0;
+
+            if (name.starts_with("access-") && name.ends_with(".hfslog")) {
+                auto digits = std::string_view{ name }.substr(7, name.size() - 7 - 7);
+                if (std::from_chars(digits.data(), digits.data() + digits.size(), seq).ec == std::errc{}) {
+                    sequence = std::max(sequence, seq);
+                }
+            }
+        }
+
+        open_segment(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+
+    void write(const AccessRecord& record) {
+        if (!segment->fits(2 * STRING_ENTRY_MAX_LEN + RECORD_ENTRY_MAX_LEN) || strings.size() >= HTTP_BINLOG_STRINGS_MAX) {
+            open_segment(record.timeUs);
+        }
+
+        auto methodId = intern({ record.method.data(), record.methodLen });
+        auto pathId = intern({ record.path.data(), record.pathLen });
+
+        put_varint(BINLOG_ENTRY_RECORD);
+        put_varint(binlog_zigzag_encode(record.timeUs - lastTimeUs));   // records of different threads may be out of order.
+        put_varint(record.durationUs);
+        put_varint(record.bytes);
+        put_varint(record.status);
+        put_varint(methodId);
+        put_varint(pathId);
+        put_varint(record.cpuUs);
+        put_varint(record.minorFaults);
+        put_varint(record.majorFaults);
+        put_varint(record.voluntarySwitches);
+        put_varint(record.tcpRttUs);
+        put_varint(record.tcpCwnd);
+        put_varint(record.tcpRetransmits);
+        put_varint(record.tcpDeliveryRate);
+        put_varint(record.tcpBusyUs);
+        put_varint(record.tcpRwndLimitedUs);
+        lastTimeUs = record.timeUs;
+
+        if (record.family == AF_INET) {
+            put_varint(BINLOG_CLIENT_IPV4);
+            std::copy_n(record.addr.begin(), 4, segment->tail());
+            segment->advance(4);
+        }
+        else if (record.family == AF_INET6) {
+            put_varint(BINLOG_CLIENT_IPV6);
+            std::copy_n(record.addr.begin(), 16, segment->tail());
+            segment->advance(16);
+        }
+        else {
+            put_varint(BINLOG_CLIENT_NONE);
+        }
+    }
+};
+
+class AccessLogger {
+    std::vector<std::unique_ptr<AccessLogRing>> rings;   // never shrinks, a ring lives as long as the logger.
+    std::unique_ptr<BinaryLogWriter> nextBinaryLog;   // set by use_binary_log(), taken by the flusher.
+
+    // the flusher's own, used without <mut>.
+    std::vector<AccessLogRing*> flushing;   // a copy of <rings>.
+    std::string lines;
+    std::unique_ptr<BinaryLogWriter> binaryLog;   // instead of the text lines, if set.
+    uint64_t reportedLost = 0;
+    std::atomic<bool> discarding{ false };
+    bool running;
+    std::mutex mut;
+    std::condition_variable cv;
+    std::thread flusher;
+
+    AccessLogRing* register_ring() {
+        std::unique_lock<std::mutex> lock{ mut };
+        rings.push_back(std::make_unique<AccessLogRing>());
+        return rings.back().get();
+    }
+
+    static void format_record(std::string& out, const AccessRecord& record) {
+        using namespace std::chrono;
+
+        sys_time<microseconds> time{ microseconds{ record.timeUs } };
+        auto days = floor<std::chrono::days>(time);
+        year_month_day ymd{ days };
+        hh_mm_ss hms{ time - days };
+
+        char client[INET6_ADDRSTRLEN] = "-";
+        if (record.family != 0) {
+            inet_ntop(record.family, record.addr.data(), client, sizeof(client));
+        }
+
+        out += std::format("time={:04}-{:02}-{:02}T{:02}:{:02}:{:02}.{:06}Z client={} method=",
+            static_cast<int>(ymd.year()), static_cast<unsigned>(ymd.month()), static_cast<unsigned>(ymd.day()),
+            hms.hours().count(), hms.minutes().count(), hms.seconds().count(), hms.subseconds().count(),
+            client);
+
+        // keep one record per line, the method is whatever came before the first space.
+        append_escaped(out, { record.method.data(), record.methodLen });
+        out += " path=\"";
+        append_escaped(out, { record.path.data(), record.pathLen });
+
+        out += std::format("\" status={} bytes={} duration_us={} cpu_us={} minflt={} majflt={} nvcsw={} rtt_us={} cwnd={} retrans={} delivery_rate={} busy_us={} rwnd_limited_us={}\n",
+            record.status, record.bytes, record.durationUs, record.cpuUs, record.minorFaults, record.majorFaults, record.voluntarySwitches,
+            record.tcpRttUs, record.tcpCwnd, record.tcpRetransmits, record.tcpDeliveryRate, record.tcpBusyUs, record.tcpRwndLimitedUs);
+    }
+
+    void write_record(const AccessRecord& record) {
+        if (binaryLog) {
+            try {
+                binaryLog->write(record);
+                return;
+            }
+            catch (const std::exception& e) {
+                print_user_error(std::format("binary access log disabled, falling back to text: {}", e.what()));
+                binaryLog.reset();
+            }
+        }
+
+        format_record(lines, record);
+    }
+
+    // called with <mut> held, takes what the other threads change.
+    void take_changes() {
+        for (auto i = flushing.size(); i < rings.size(); ++i) {
+            flushing.push_back(rings[i].get());
+        }
+
+        if (nextBinaryLog) {
+            binaryLog = std::move(nextBinaryLog);
+        }
+    }
+
+    // called without <mut>, so a thread registering its ring never waits for stdout.
+    void flush() {
+        uint64_t lost = 0;
+
+        lines.clear();
+        for (auto ring : flushing) {
+            ring->drain([this](const AccessRecord& record) { write_record(record); });
+            lost += ring->dropped_count() + ring->sampled_out_count();
+        }
+
+        if (!lines.empty()) {
+            std::cout.write(lines.data(), static_cast<std::streamsize>(lines.size())).flush();
+        }
+
+        if (lost != reportedLost) {
+            uint64_t dropped = 0;
+            uint64_t sampledOut = 0;
+            for (auto ring : flushing) {
+                dropped += ring->dropped_count();
+                sampledOut += ring->sampled_out_count();
+            }
+
+            print_user_error(std::format("access log under load, {} records dropped, {} sampled out so far", dropped, sampledOut));
+            reportedLost = lost;
+        }
+    }
+public:
+    AccessLogger()
+        : running{ true }
+    {
+        flusher = std::thread([this]() {
+            std::unique_lock<std::mutex> lock{ mut };
+
+            while (running) {
+                cv.wait_for(lock, std::chrono::milliseconds(HTTP_LOG_FLUSH_INTERVAL_MS), [this]() { return !running; });
+                take_changes();
+
+                lock.unlock();
+                flush();
+                lock.lock();
+            }
+        });
+    }
+
+    ~AccessLogger() noexcept {
+        {
+            std::unique_lock<std::mutex> lock{ mut };
+            running = false;
+        }
+
+        cv.notify_all();
+        flusher.join();
+    }
+
+    // switch to the binary format, the segments are written into <dir>.
+    void use_binary_log(const fs::path& dir) {
+        auto writer = std::make_unique<BinaryLogWriter>(dir);
+
+        std::unique_lock<std::mutex> lock{ mut };
+        nextBinaryLog = std::move(writer);
+    }
+
+    // drop the records instead, for the benchmarks that run requests in memory.
+    void discard(bool on) noexcept {
+        discarding.store(on, std::memory_order_relaxed);
+    }
+
+    void log(const AccessRecord& record) noexcept {
+        if (discarding.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        thread_local AccessLogRing* ring = register_ring();
+        ring->push(record);
+    }
+};
+
+static AccessLogger accessLogger;
+
+/*
+* the policies a BasicHttpConnection is made of, each one is a plain class, so the calls are direct and inlined.
+*
+* Transport, where the request is read from and the response written to, owned by the connection:
+*   bool prepare()                            before the first recv(), false if the connection can't go on.
+*   int64_t recv(char*, size_t)               like recv() and send(): the bytes moved, 0 if the peer has closed,
+*   int64_t send(const char*, size_t)         negative on an error.
+*   TcpSample tcp_sample() const noexcept
+*   uint64_t handle() const noexcept          the socket, for the accept probe.
+* SocketTransport is the accepted socket, MemoryTransport takes the request from memory and keeps the response,
+* so a request can run without the kernel, like in the benchmarks.
+*
+* FileSource, how serve_file() gets the content of a file, one per response:
+*   bool open(const fs::path&)                false if it can't be read.
+*   std::string_view content() const noexcept valid as long as the source.
+* StreamFileSource reads it into memory, MappedFileSource maps it.
+*
+* Cache, where the listings of directories come from, static functions:
+*   std::shared_ptr<const DirListing> get(const fs::path&)
+*   size_t size()                             listings held, for /__metrics.
+* SharedDirCache is dirListingCache, NoDirCache collects every time.
+*
+* Logger, what becomes of the access records, static:
+*   ENABLED                                   false leaves the record out of start() entirely.
+*   void log(const AccessRecord&) noexcept
+* RingAccessLogger hands them to accessLogger, NullAccessLogger drops them.
+*/
+class SocketTransport {
+    SOCKET sock;
+public:
+    explicit SocketTransport(SOCKET _sock) :
+        sock{ _sock }
+    {}
+
+    SocketTransport(SocketTransport&& other) noexcept :
+        sock{ std::exchange(other.sock, INVALID_SOCKET) }
+    {}
+
+    SocketTransport(const SocketTransport&) = delete;
+    SocketTransport& operator=(const SocketTransport&) = delete;
+
+    ~SocketTransport() {
+        if (sock != INVALID_SOCKET) {
+            if (shutdown(sock, SD_SEND) != 0) {   // half close.
+                print_last_sys_error("error shutdown()");
+            }
+
+            if (closesocket(sock) != 0) {
+                print_last_sys_error("error closesocket()");
+            }
+        }
+    }
+
+    bool prepare() {
+        // set receive time out, winsock takes milliseconds in a DWORD, POSIX takes a timeval.
+#ifdef _WIN32
+        uint32_t recvTimeOut = HTTP_RECV_TIMEOUT_SEC * 1000;
+#else
+        timeval recvTimeOut{ HTTP_RECV_TIMEOUT_SEC, 0 };
+#endif
+        if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&recvTimeOut), sizeof(recvTimeOut)) != 0) {
+            print_last_sys_error("error setsockopt() on SO_RCVTIMEO");
+            return false;
+        }
+        return true;
+    }
 
-static void throw_last_sys_error(const std::string& msg, const std::source_location& slc = std::source_location::current()) {
-    auto ec = get_last_sys_ec();
-    throw std::runtime_error{ std::format("{}, {}({}): {}, {}", slc.file_name(), slc.function_name(), slc.line(), msg, ec.message()) };
-}
+    int64_t recv(char* buffer, size_t len) {
+        return ::recv(sock, buffer, static_cast<int>(len), 0);
+    }
 
-static void throw_user_error(const std::string& msg, const std::source_location& slc = std::source_location::current()){
-    throw std::runtime_error{ std::format("{}, {}({}): {}", slc.file_name(), slc.function_name(), slc.line(), msg) };
-}
+    int64_t send(const char* data, size_t len) {
+        return ::send(sock, data, static_cast<int>(len), 0);
+    }
 
-static std::wstring conv_ascii_to_unicode(const std::string& str) {
-    auto len = MultiByteToWideChar(CP_ACP, 0, str.c_str(), -1, nullptr, 0);
-    if (len == 0) {
-        throw_last_sys_error("conv_ascii_to_unicode() failed");
+    TcpSample tcp_sample() const noexcept {
+        return TcpSample::of(sock);
     }
 
-    std::wstring buffer(len, wchar_t{});
-    len = MultiByteToWideChar(CP_ACP, 0, str.c_str(), -1, &buffer[0], len);
-    if (len == 0) {
-        throw_last_sys_error("conv_ascii_to_unicode() failed");
+    uint64_t handle() const noexcept {
+        return static_cast<uint64_t>(sock);
     }
+};
 
-    /*
-    * a very tricky thing here is, if the underlying string stored in fs::path <p> ends with '\0',
-    * when you pass the <p> to the fs::directory_iterator, you would get a file not found exception.
-    * but if I pass <p.c_str()> to the fs::directory_iterator, then that will work as expected. I tested it on
-    * the visual studio and clang++, and both represent this bug, but '\0' doesn't influence the functions like
-    * fs::is_directory or fs::is_regular_file, so this is really interesting.
-    *
-    * This function and the functions below are all doing the encoding conversion,
-    * and all of the <len> used in the functions contains '\0', to prevent the tricky behaviour like fs::directory_iterator,
-    * we resize the buffer to ignore the tail '\0'.
-    */
-    buffer.resize(len - 1);
-    return buffer;
-}
+class MemoryTransport {
+    std::string_view input;   // what is left of the request, it must outlive the transport.
+    std::string output;
+    uint64_t bytesOut = 0;
+    bool keepOutput;
+public:
+    // <keep> false only counts the response, for timing many requests.
+    explicit MemoryTransport(std::string_view request, bool keep = true) :
+        input{ request },
+        keepOutput{ keep }
+    {}
 
-static std::string conv_unicode_to_ascii(const std::wstring& wstr) {
-    auto len = WideCharToMultiByte(CP_ACP, 0, wstr.c_str(), -1, nullptr, 0, nullptr, nullptr);
-    if (len == 0) {
-        throw_last_sys_error("conv_unicode_to_ascii() failed");
+    bool prepare() {
+        return true;
+    }
+
+    int64_t recv(char* buffer, size_t len) {
+        auto n = std::min(len, input.size());
+        std::copy_n(input.data(), n, buffer);
+        input.remove_prefix(n);
+        return static_cast<int64_t>(n);
     }
 
-    std::string buffer(len, char{});
+    int64_t send(const char* data, size_t len) {
+        if (keepOutput) {
+            output.append(data, len);
+        }
+        bytesOut += len;
+        return static_cast<int64_t>(len);
+    }
 
-    if (WideCharToMultiByte(CP_ACP, 0, wstr.c_str(), -1, &buffer[0], len, nullptr, nullptr) == 0) {
-        throw_last_sys_error("conv_unicode_to_ascii() failed");
+    TcpSample tcp_sample() const noexcept {
+        return {};
     }
 
-    buffer.resize(len - 1);   // same reason as std::wstring conv_ascii_to_unicode(const std::string& str);
-    return buffer;
-}
+    uint64_t handle() const noexcept {
+        return 0;
+    }
 
-static std::wstring conv_utf8_to_unicode(const std::string& str) {
-    auto len = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, nullptr, 0);
-    if (len == 0) {
-        throw_last_sys_error("conv_utf8_to_unicode() failed");
+    const std::string& response() const noexcept {
+        return output;
     }
 
-    std::wstring buffer(len, wchar_t{});
-    MultiByteToWideChar(CP_UTF8, 0, str.c_str(), -1, &buffer[0], len - 1);
-    if (len == 0) {
-        throw_last_sys_error("conv_utf8_to_unicode() failed");
+    uint64_t bytes_sent() const noexcept {
+        return bytesOut;
     }
+};
 
-    buffer.resize(len - 1);   // same reason as std::wstring conv_ascii_to_unicode(const std::string& str);
-    return buffer;
-}
+// the one stat of a request path: its type, and the size and last write time (seconds since the unix epoch) for the ETag.
+struct PathStat {
+    fs::file_type type = fs::file_type::not_found;
+    uintmax_t size = 0;
+    int64_t mtime = 0;
+};
 
-static std::string conv_utf8_to_ascii(const std::string& str) {
-    std::wstring wstr = conv_utf8_to_unicode(str);
-    return conv_unicode_to_ascii(wstr);
-}
+// follows symlinks like fs::status, an error is not found.
+static PathStat stat_path(const fs::path& p) noexcept {
+    PathStat result;
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (GetFileAttributesExW(p.c_str(), GetFileExInfoStandard, &data) == 0) {
+        return result;
+    }
 
-static std::string conv_unicode_to_utf8(const std::wstring& wstr) {
-    std::string result;
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {   // these describe the link, not its target.
+        std::error_code ec;
+        result.type = fs::status(p, ec).type();
+        return result;
+    }
 
-    for (wchar_t c : wstr) {
-        auto i = static_cast<uint32_t>(c);   // as you can see, the parameter could also be u32string.
+    result.type = data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ? fs::file_type::directory : fs::file_type::regular;
+    result.size = (static_cast<uintmax_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
 
-        if (i < 0x80) {
-            result += static_cast<char>(i);
-        }
-        else if (i < 0x800) {
-            result += static_cast<char>(0xc0 | (i >> 6));
-            result += static_cast<char>(0x80 | (i & 0x3f));
-        }
-        else if (i < 0x10000) {
-            result += static_cast<char>(0xe0 | (i >> 12));
-            result += static_cast<char>(0x80 | ((i >> 6) & 0x3f));
-            result += static_cast<char>(0x80 | (i & 0x3f));
-        }
-        else if (i < 0x200000) {
-            result += static_cast<char>(0xf0 | (i >> 18));
-            result += static_cast<char>(0x80 | ((i >> 12) & 0x3f));
-            result += static_cast<char>(0x80 | ((i >> 6) & 0x3f));
-            result += static_cast<char>(0x80 | (i & 0x3f));
-        }
-        else {
-            result += static_cast<char>(0xf8 | (i >> 24));
-            result += static_cast<char>(0x80 | ((i >> 18) & 0x3f));
-            result += static_cast<char>(0x80 | ((i >> 12) & 0x3f));
-            result += static_cast<char>(0x80 | ((i >> 6) & 0x3f));
-            result += static_cast<char>(0x80 | (i & 0x3f));
-        }
+    // FILETIME counts 100ns from 1601.
+    auto ticks = (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+    result.mtime = static_cast<int64_t>(ticks / 10'000'000) - 11'644'473'600;
+#else
+    struct stat st;
+    if (::stat(p.c_str(), &st) != 0) {
+        return result;
     }
 
+    result.type = S_ISDIR(st.st_mode) ? fs::file_type::directory : S_ISREG(st.st_mode) ? fs::file_type::regular : fs::file_type::unknown;
+    result.size = static_cast<uintmax_t>(st.st_size);
+    result.mtime = static_cast<int64_t>(st.st_mtime);
+#endif
     return result;
 }
 
-/*
-    Thread pool.
-    This thread pool ignores the return value, so you have to push some functions like: void my_func(void);
-    Drawing inspiration from Jakob Progsch and yhirose's thread pool implementation.
-*/
-class ThreadPool {
-    bool running;
-    std::queue<std::function<void()>> taskQueue;
-    std::vector<std::thread> workers;
-    std::mutex mut;
-    std::condition_variable cv;
+class StreamFileSource {
+    std::string data;
 public:
-    explicit ThreadPool(size_t numOfWorkers)
-        : running{ true }
-    {
-        for (size_t i = 0; i < numOfWorkers; ++i) {
-            workers.emplace_back([this]() {
-                while (true) {
-                    std::function<void()> task;
-
-                    {
-                        std::unique_lock<std::mutex> lock{ mut };
-                        cv.wait(lock, [this]() { return !running || !taskQueue.empty(); });
+    bool open(const fs::path& p) {
+        std::ifstream file(p, std::ios::binary);
+        if (!file) {
+            return false;
+        }
 
-                        if (!running && taskQueue.empty()) {
-                            return;
-                        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        data = buffer.str();
+        return true;
+    }
 
-                        task = std::move(taskQueue.front());
-                        taskQueue.pop();
-                    }
+    std::string_view content() const noexcept {
+        return data;
+    }
+};
 
-                    task();
-                }
-                });
+/*
+    the file is mapped read only instead of copied, the pages come from the page cache. a file cut shorter while
+    it is sent faults the server on POSIX (SIGBUS), so this is for trees that don't change under it.
+*/
+class MappedFileSource {
+    const char* data = nullptr;
+    size_t len = 0;
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#endif
+
+    void unmap() noexcept {
+        if (data == nullptr) {
+            return;
         }
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle(mapping);
+        mapping = nullptr;
+#else
+        munmap(const_cast<char*>(data), len);
+#endif
+        data = nullptr;
+        len = 0;
     }
+public:
+    MappedFileSource() = default;
+    MappedFileSource(const MappedFileSource&) = delete;
+    MappedFileSource& operator=(const MappedFileSource&) = delete;
 
-    ThreadPool() : ThreadPool{ std::thread::hardware_concurrency() } {}
+    ~MappedFileSource() noexcept {
+        unmap();
+    }
 
-    ~ThreadPool() noexcept {
-        {
-            /* first set running to false. */
-            std::unique_lock<std::mutex> lock{ mut };
-            running = false;
+    bool open(const fs::path& p) {
+        unmap();
+
+#ifdef _WIN32
+        auto file = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
         }
 
-        cv.notify_all();
-        for (std::thread& worker : workers) {
-            worker.join();
+        LARGE_INTEGER size;
+        bool ok = GetFileSizeEx(file, &size) != 0;
+        if (ok && size.QuadPart > 0) {   // an empty file can't be mapped, and needs no mapping.
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            data = mapping == nullptr ? nullptr : static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            ok = data != nullptr;
+            if (!ok && mapping != nullptr) {
+                CloseHandle(mapping);
+                mapping = nullptr;
+            }
+            len = ok ? static_cast<size_t>(size.QuadPart) : 0;
+        }
+        CloseHandle(file);
+        return ok;
+#else
+        int fd = ::open(p.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
         }
-    }
 
-    void add_task(std::function<void()> task) {
-        {
-            std::unique_lock<std::mutex> lock{ mut };
-            taskQueue.emplace(std::move(task));
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        if (ok && st.st_size > 0) {
+            void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = addr != MAP_FAILED;
+            if (ok) {
+                data = static_cast<const char*>(addr);
+                len = static_cast<size_t>(st.st_size);
+            }
         }
+        close(fd);   // the mapping keeps the file.
+        return ok;
+#endif
+    }
 
-        cv.notify_one();
+    std::string_view content() const noexcept {
+        return { data, len };
     }
 };
 
-/*
-    on windows platform, before you could use socket,
-    you have to use WSAStartup() and finally use WSACleanup(),
-    so this RAII class is needed.
-*/
-class WSASetup {
-public:
-    WSASetup() {
-        WSADATA wsaData;
+struct SharedDirCache {
+    static std::shared_ptr<const DirListing> get(const fs::path& dir) {
+        return dirListingCache.get(dir);
+    }
 
-        WORD wVersionRequested = MAKEWORD(2, 2);
-        if (WSAStartup(wVersionRequested, &wsaData) != 0) {
-            throw_last_sys_error("WSAStartup() failed");
-        }
+    static size_t size() {
+        return dirListingCache.size();
     }
+};
 
-    ~WSASetup() noexcept {
-        WSACleanup();
+struct NoDirCache {
+    static std::shared_ptr<const DirListing> get(const fs::path& dir) {
+        auto listing = std::make_shared<DirListing>();
+        listing->collect(dir);
+        return listing;
+    }
+
+    static size_t size() {
+        return 0;
     }
 };
 
-static WSASetup wsaSetup;
+struct RingAccessLogger {
+    static constexpr bool ENABLED = true;
+
+    static void log(const AccessRecord& record) noexcept {
+        accessLogger.log(record);
+    }
+};
+
+struct NullAccessLogger {
+    static constexpr bool ENABLED = false;
+
+    static void log(const AccessRecord&) noexcept {}
+};
 
 /*
-* http connection, it will handle the http request and response.
+* http connection, it will handle the http request and response, made of the policies above.
 */
-class HttpConnection {
-    SOCKET sock;
-    std::wstring rootPath;
+template <class Transport, class FileSource, class Cache, class Logger>
+class BasicHttpConnection {
+    friend class HttpConnectionBench;   // bench/MicroBench.cpp times the private steps.
+
+    Transport transport;
+    sockaddr_storage client;
+    const native_string& rootPath;
     std::string request;
     std::string method;
     std::string uri;
+    uint16_t status = 0;   // of the response sent, 0 if none.
+    uint64_t bytesSent = 0;   // body bytes.
+    uint64_t id;
+    ConnectionSlot* slot = nullptr;   // of the worker, set by start().
+    std::chrono::steady_clock::time_point accepted;
+    std::array<std::chrono::steady_clock::time_point, STAGE_COUNT> stageEnds{};
+    std::chrono::steady_clock::time_point lastTcpSample;   // the periodic TCP_INFO of a long response.
+
+    void mark(RequestStage stage) noexcept {
+        stageEnds[stage] = std::chrono::steady_clock::now();
+    }
+
+    // stage durations in us, a skipped stage ends where the previous one did.
+    std::array<uint64_t, STAGE_COUNT> stage_durations() noexcept {
+        std::array<uint64_t, STAGE_COUNT> stageUs;
+        auto prev = accepted;
+
+        for (size_t i = 0; i < STAGE_COUNT; ++i) {
+            if (stageEnds[i] == std::chrono::steady_clock::time_point{}) {
+                stageEnds[i] = prev;
+            }
+
+            stageUs[i] = std::chrono::duration_cast<std::chrono::microseconds>(stageEnds[i] - prev).count();
+            prev = stageEnds[i];
+        }
+
+        return stageUs;
+    }
 
     bool string_icompare(const std::string& left, const std::string& right){
         return std::ranges::equal(left, right, [](char c1, char c2){
@@ -331,82 +3461,164 @@ class HttpConnection {
         uri = decodeUri;
     }
 
-    void http_response_send(const std::string& response) {
-        send(sock, response.c_str(), static_cast<int>(response.size()), 0);
+    // send() may take only a part of the data, returns the bytes sent before an error, if any.
+    size_t http_response_send(std::string_view response) {
+        size_t sent = 0;
+        HFS_PROBE2(send_start, id, response.size());
+        slot->set_state(CONNECTION_SENDING);
+
+        while (sent < response.size()) {
+            auto chunk = std::min<size_t>(response.size() - sent, HTTP_SEND_CHUNK_LEN);   // so a long transfer shows its progress.
+            auto len = transport.send(response.data() + sent, chunk);
+            if (len <= 0) {
+                break;
+            }
+            sent += static_cast<size_t>(len);
+            slot->add_bytes(static_cast<uint64_t>(len));
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastTcpSample >= std::chrono::milliseconds{ HTTP_TCP_SAMPLE_MS }) {
+                lastTcpSample = now;
+                auto sample = transport.tcp_sample();
+                slot->set_tcp(sample);
+                metrics.local().tcpRtt.record(sample.rttUs);
+                HFS_PROBE3(tcp_sample, id, sample.rttUs, sample.cwnd);
+            }
+        }
+
+        HFS_PROBE2(send_complete, id, sent);
+        return sent;
+    }
+
+    template <size_t H, size_t B>
+    void http_response_send(const StatusResponse<H, B>& response) {
+        static_assert(H + B + 64 < HTTP_HEADER_BUFFER_LEN, "status response doesn't fit in the header buffer");
+
+        ResponseHeader header;
+        header.append(response.head.view())
+            .append(httpDate.line())
+            .append("\r\n")
+            .append(response.body.view());
+
+        mark(STAGE_BUILD);
+        status = response.code;
+        bytesSent = http_response_send(header.view()) == header.view().size() ? B : 0;
     }
 
-    void serve_file(const fs::path& p) {
+    void serve_file(const fs::path& p, const PathStat& st) {
         auto extension = p.extension().string();
         auto iter = HTTP_MIME_TABLE.find(extension);
-        std::string contentType;
+        std::string_view contentType;
 
         if (iter != HTTP_MIME_TABLE.cend()) {
             contentType = iter->second;
         }
         else {
-            contentType = "text/plain";
+            contentType = HTTP_CONTENT_TYPE<"text/plain">.view();
         }
 
-        std::ifstream file(p, std::ios::binary);
-        if (file) {
-            std::stringstream buffer;
-            buffer << file.rdbuf();
-            std::string content = buffer.str();
-
-            std::string response = "HTTP/1.1 200 OK\r\nServer: Miku Server\r\nConnection: close\r\n";
-            response += "Content-Type: " + contentType + "\r\n";
-            response += "Content-Length: " + std::to_string(content.size()) + "\r\n";
-            response += "\r\n";
-
-            send(sock, response.c_str(), static_cast<int>(response.size()), 0);
-            send(sock, content.c_str(), static_cast<int>(content.size()), 0);
+        FileSource file;
+        bool opened = file.open(p);
+        HFS_PROBE3(file_open, id, p.c_str(), opened);
+
+        if (opened) {
+            auto content = file.content();
+
+            ResponseHeader header;
+            header.append(HTTP_HEADER_200_OK.view())
+                .append(contentType)
+                .append("Content-Length: ").append_number(content.size()).append("\r\n")
+                .append(httpDate.line())
+                .append("ETag: W/\"").append_number(static_cast<uintmax_t>(std::max<int64_t>(st.mtime, 0)), 16).append("-").append_number(st.size, 16).append("\"\r\n")   // weak: the stat is not atomic with the read.
+                .append("\r\n");
+
+            mark(STAGE_BUILD);
+            status = 200;
+            http_response_send(header.view());
+            bytesSent = http_response_send(content);
         }
         else {
             http_response_send(HTTP_404_NOT_FOUND);
         }
     }
 
-    std::string build_file_size(uintmax_t size) {   // beautify format.
-        if (size < 1024) {
-            return std::to_string(size) + " Bytes";
-        }
-        else if (size >= 1024 && size < 1024 * 1024) {
-            return std::to_string(size / 1024) + " KB";
-        }
-        else if (size >= 1024 * 1024 && size < 1024 * 1024 * 1024) {
-            return std::to_string(size / 1024 / 1024) + " MB";
-        }
-        else {
-            return std::to_string(size / 1024 / 1024 / 1024) + " GB";
-        }
+    void serve_dir(const fs::path& p) {
+        thread_local OutputBuffer body;
+        thread_local std::string nameScratch;
+
+        auto listing = Cache::get(p);
+
+        body.clear();
+        listing->render(body, path_to_utf8(p.native(), nameScratch));
+
+        ResponseHeader header;
+        header.append(HTTP_HEADER_200_OK.view())
+            .append(HTTP_CONTENT_TYPE<"text/html; charset=utf-8">.view())
+            .append("Content-Length: ").append_number(body.size()).append("\r\n")
+            .append(httpDate.line())
+            .append("\r\n");
+
+        mark(STAGE_BUILD);
+        status = 200;
+        http_response_send(header.view());
+        bytesSent = http_response_send(body.view());
     }
 
-    void serve_dir(const fs::path& p) {
-        std::string response = "HTTP/1.1 200 OK\r\nServer: Miku Server\r\nConnection: close\r\n";
-        std::string body = "<html><header><h1>Miku Server</h1></header><body>";
-        body += "Current dir: " + conv_unicode_to_utf8(p.wstring()) + "<br><br>";
+    // a response generated by the server itself, from <body>.
+    void serve_generated(std::string_view contentType, const OutputBuffer& body) {
+        ResponseHeader header;
+        header.append(HTTP_HEADER_200_OK.view())
+            .append(contentType)
+            .append("Content-Length: ").append_number(body.size()).append("\r\n")
+            .append(httpDate.line())
+            .append("\r\n");
+
+        mark(STAGE_BUILD);
+        status = 200;
+        http_response_send(header.view());
+        bytesSent = http_response_send(body.view());
+    }
 
-        for (const auto& entry : fs::directory_iterator(p, fs::directory_options::skip_permission_denied)) {
-            /*
-            * It is necessary to use Unicode to process paths on the Windows platform,
-            * while for HTML pages, we use UTF-8.
-            */
-            std::string name = conv_unicode_to_utf8(entry.path().filename().wstring());
+    void serve_connections() {
+        thread_local OutputBuffer body;
 
-            if (fs::is_directory(entry)) {
-                body += "<a href='" + name + "/'>" + name + "/</a><br>";
-            }
-            else {
-                body += "<a href='" + name + "'>" + name + "</a>   " + build_file_size(fs::file_size(entry)) + " <br>";
-            }
-        }
+        body.clear();
+        connectionRegistry.render(body);
+        serve_generated(HTTP_CONTENT_TYPE<"text/plain; charset=utf-8">.view(), body);
+    }
+
+    void serve_top() {
+        thread_local OutputBuffer body;
+
+        body.clear();
+        metrics.render_top(body);
+        serve_generated(HTTP_CONTENT_TYPE<"text/plain; charset=utf-8">.view(), body);
+    }
 
-        body += "</body></html>";
-        response += "Content-Type: text/html; charset=utf-8\r\n";
-        response += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
-        response += body;
+    void serve_metrics() {
+        thread_local OutputBuffer body;
 
-        send(sock, response.c_str(), static_cast<int>(response.size()), 0);
+        body.clear();
+        metrics.render(body);
+        body.append("# HELP hfs_dir_cache_entries Directory listings in the cache.\n# TYPE hfs_dir_cache_entries gauge\nhfs_dir_cache_entries ");
+        body.append_number(Cache::size());
+        body.append("\n");
+        serve_generated(HTTP_CONTENT_TYPE<"text/plain; version=0.0.4; charset=utf-8">.view(), body);
+    }
+
+    void serve_trace(std::string_view action) {
+        thread_local OutputBuffer body;
+
+        body.clear();
+        if (action.empty()) {
+            tracer.render(body);
+            serve_generated(HTTP_CONTENT_TYPE<"application/json">.view(), body);
+        }
+        else {
+            tracer.enable(action == "/on");
+            body.append(tracer.enabled() ? "tracing on\n" : "tracing off\n");
+            serve_generated(HTTP_CONTENT_TYPE<"text/plain">.view(), body);
+        }
     }
 
     void process_request() {
@@ -426,7 +3638,8 @@ class HttpConnection {
         }
 
         method = request.substr(0, index);
-        if (!string_icompare("GET", method)) {
+        bool post = string_icompare("POST", method);   // only to switch tracing.
+        if (!string_icompare("GET", method) && !post) {
             http_response_send(HTTP_405_METHOD_NOT_ALLOWED);
             return;
         }
@@ -446,51 +3659,109 @@ class HttpConnection {
 
         fs::path p{ rootPath };
         uri_decode();   // decode the percent-encoding.
+        mark(STAGE_PARSE);
+        HFS_PROBE3(request_parsed, id, method.c_str(), uri.c_str());
+        slot->set_path(uri);
+        slot->set_state(CONNECTION_PROCESSING);
+
+        // these shadow files of the same names in the root.
+        if (uri == HTTP_METRICS_URI && !post) {
+            serve_metrics();
+            return;
+        }
+
+        if (adminEndpoints && is_loopback(client)) {
+            if (uri == HTTP_TOP_URI && !post) {
+                serve_top();
+                return;
+            }
+
+            if (uri == HTTP_CONNECTIONS_URI && !post) {
+                serve_connections();
+                return;
+            }
+
+            if (uri.starts_with(HTTP_TRACE_URI)) {
+                auto action = std::string_view{ uri }.substr(HTTP_TRACE_URI.size());
+                if (action.empty() || action == "/on" || action == "/off") {
+                    if (post == action.empty()) {   // the dump is a GET, switching a POST.
+                        http_response_send(HTTP_405_METHOD_NOT_ALLOWED);
+                        return;
+                    }
+
+                    serve_trace(action);
+                    return;
+                }
+            }
+        }
+
+        if (post) {   // the files are only for GET.
+            http_response_send(HTTP_405_METHOD_NOT_ALLOWED);
+            return;
+        }
 
         if (uri != "/") {   // if uri is not '/', concatenate the path.
-            p /= conv_utf8_to_unicode(uri);   // It is necessary to use Unicode to process paths on the Windows platform.
+            thread_local native_string uriScratch;
+            native_string_view relative;
+
+            if (!path_from_uri(uri, uriScratch, relative)) {   // as if it didn't exist.
+                mark(STAGE_RESOLVE);
+                http_response_send(HTTP_404_NOT_FOUND);
+                return;
+            }
+            p /= relative;
         }
 
-        std::osyncstream(std::cout) << conv_unicode_to_ascii(p.wstring()) << "\n";
+        auto st = stat_path(p);   // one stat for both checks and the ETag.
+        mark(STAGE_RESOLVE);
 
-        if (fs::is_directory(p)) {
+        if (st.type == fs::file_type::directory) {
             serve_dir(p);
         }
-        else if (fs::is_regular_file(p)) {
-            serve_file(p);
+        else if (st.type == fs::file_type::regular) {
+            serve_file(p, st);
         }
         else {   // not directory or file are considered as not found.
             http_response_send(HTTP_404_NOT_FOUND);
         }
     }
 public:
-    HttpConnection(SOCKET _sock, const std::string& _rootPath) :
-        sock{ _sock },
-        rootPath{ conv_ascii_to_unicode(_rootPath) },
-        request(HTTP_RECV_BUFFER_LEN, char{})
-    {}
+    BasicHttpConnection(Transport _transport, const sockaddr_storage& _client, const native_string& _rootPath) :
+        transport{ std::move(_transport) },
+        client{ _client },
+        rootPath{ _rootPath },
+        request(HTTP_RECV_BUFFER_LEN, char{}),
+        id{ tracer.next_id() },
+        accepted{ std::chrono::steady_clock::now() }
+    {
+        HFS_PROBE2(accept, id, transport.handle());
+    }
 
-    ~HttpConnection() {
-        if (sock != INVALID_SOCKET) {
-            if (shutdown(sock, SD_SEND) != 0) {   // half close.
-                print_last_sys_error("error shutdown()");
-            }
+    ~BasicHttpConnection() {
+        metrics.local().connectionsClosed.add();
+    }
 
-            if (closesocket(sock) != 0) {
-                print_last_sys_error("error closesocket()");
-            }
-        }
+    // the response of a MemoryTransport is read from it after start().
+    const Transport& get_transport() const noexcept {
+        return transport;
     }
 
     void start() {
-        // set receive time out.
-        uint32_t recvTimeOut = HTTP_RECV_TIMEOUT_SEC * 1000;
-        if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&recvTimeOut), sizeof(recvTimeOut)) != 0) {
-            print_last_sys_error("error setsockopt() on SO_RCVTIMEO");
+        auto wallBegin = std::chrono::system_clock::now();
+        auto begin = std::chrono::steady_clock::now();
+        auto usageBegin = ResourceUsage::of_this_thread();
+        stageEnds[STAGE_QUEUE] = begin;
+        lastTcpSample = begin;
+
+        if (!transport.prepare()) {
             return;
         }
 
-        auto len = recv(sock, &request[0], HTTP_RECV_BUFFER_LEN, 0);
+        slot = &connectionRegistry.local();
+        slot->begin(id, accepted, client);
+
+        auto len = transport.recv(&request[0], HTTP_RECV_BUFFER_LEN);
+        mark(STAGE_RECV);
 
         if (len < 0) {
             print_last_sys_error("error recv()");
@@ -501,11 +3772,84 @@ public:
         else {
             process_request();
         }
+        slot->set_state(CONNECTION_IDLE);
+
+        if (status != 0) {
+            mark(STAGE_SEND);
+
+            auto stageUs = stage_durations();
+            auto totalUs = std::chrono::duration_cast<std::chrono::microseconds>(stageEnds[STAGE_SEND] - accepted).count();
+            auto usage = ResourceUsage::of_this_thread() - usageBegin;
+            auto tcp = transport.tcp_sample();   // the response is in the socket buffer, not necessarily acked.
+            auto& local = metrics.local();
+            local.count_stages(stageUs);
+            local.count_tcp(tcp);
+            // only a path that was served names a prefix, the rest are made up by the clients and would fill the table.
+            local.prefixUsage.count(status >= 200 && status < 300 ? path_prefix(uri) : "unresolved", usage);
+            local.heavyHitters.count(uri, client, stageEnds[STAGE_SEND]);
+
+            if (totalUs >= HTTP_SLOW_REQUEST_MS * 1000) {   // rare, so it is written right away.
+                std::string escapedMethod;
+                std::string escapedPath;
+                append_escaped(escapedMethod, method);
+                append_escaped(escapedPath, uri);
+
+                std::osyncstream(std::cerr) << std::format("slow request: method={} path=\"{}\" status={} bytes={} total_us={} "
+                    "queue_us={} recv_us={} parse_us={} resolve_us={} build_us={} send_us={}\n",
+                    escapedMethod, escapedPath, status, bytesSent, totalUs,
+                    stageUs[STAGE_QUEUE], stageUs[STAGE_RECV], stageUs[STAGE_PARSE], stageUs[STAGE_RESOLVE], stageUs[STAGE_BUILD], stageUs[STAGE_SEND]);
+            }
+
+            if (tracer.enabled()) {
+                TraceRecord trace;
+                trace.id = id;
+                trace.accepted = accepted;
+                trace.stageEnds = stageEnds;
+                trace.bytes = bytesSent;
+                trace.status = status;
+                trace.pathLen = static_cast<uint16_t>(std::min(uri.size(), trace.path.size()));
+                std::copy_n(uri.data(), trace.pathLen, trace.path.data());
+                tracer.record(trace);
+            }
+
+            auto durationUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count();
+            local.count_request(status, bytesSent, durationUs);
+
+            if constexpr (Logger::ENABLED) {
+                AccessRecord record;
+                record.timeUs = std::chrono::duration_cast<std::chrono::microseconds>(wallBegin.time_since_epoch()).count();
+                record.durationUs = durationUs;
+                record.set_usage(usage);
+                record.set_tcp(tcp);
+                record.bytes = bytesSent;
+                record.status = status;
+                record.set_client(client);
+                record.set_request(method, uri);
+                Logger::log(record);
+            }
+        }
     }
 };
 
+// the server's, define HFS_MAPPED_FILES to map the files instead of reading them, HFS_NO_ACCESS_LOG to log nothing.
+using HttpConnection = BasicHttpConnection<
+    SocketTransport,
+#ifdef HFS_MAPPED_FILES
+    MappedFileSource,
+#else
+    StreamFileSource,
+#endif
+    SharedDirCache,
+#ifdef HFS_NO_ACCESS_LOG
+    NullAccessLogger
+#else
+    RingAccessLogger
+#endif
+>;
+
 class HttpFileServer {
     SOCKET server;
+    native_string rootPath;   // converted once, shared by all the connections, the pool is destroyed first.
     ThreadPool pool;
 
     void bind_listen(const std::string& ip, uint16_t port) {
@@ -522,6 +3866,12 @@ class HttpFileServer {
             throw_user_error("given ip is not a valid IPv4 dotted-decimal string or a valid IPv6 address string");
         }
 
+        // on POSIX systems, SO_REUSEADDR only takes effect when it is set before bind().
+        int option = 1;
+        if (setsockopt(server, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&option), sizeof(option)) != 0) {
+            throw_last_sys_error("error setsockopt() on SO_REUSEADDR");
+        }
+
         if (bind(server, (const struct sockaddr*)(&addr_in), sizeof(struct sockaddr_in)) != 0) {
             throw_last_sys_error("error bind()");
         }
@@ -530,10 +3880,7 @@ class HttpFileServer {
             throw_last_sys_error("error listen()");
         }
 
-        int option = 1;
-        if (setsockopt(server, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&option), sizeof(option)) != 0) {
-            throw_last_sys_error("error setsockopt() on SO_REUSEADDR");
-        }
+        metrics.set_listener(server);
     }
 public:
     HttpFileServer() {
@@ -553,34 +3900,65 @@ public:
 
     void serve(const std::string& ip, uint16_t port, const std::string& rootPath) {
         bind_listen(ip, port);
+        this->rootPath = path_from_command_line(rootPath);
 
         while (true) {
-            SOCKET s = accept(server, nullptr, nullptr);
+            sockaddr_storage client{};
+            socklen_t clientLen = sizeof(client);
+
+            SOCKET s = accept(server, reinterpret_cast<sockaddr*>(&client), &clientLen);
             if (s == INVALID_SOCKET) {
                 throw_last_sys_error("error accept()");
             }
 
-            auto connection = std::make_shared<HttpConnection>(s, rootPath);
+            metrics.local().connectionsAccepted.add();
+            auto connection = std::make_shared<HttpConnection>(SocketTransport{ s }, client, this->rootPath);
             pool.add_task([connection]() { connection->start(); });
         }
     }
 };
 
+#ifndef HFS_NO_MAIN   // defined by the benchmarks that include this file.
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <port> <root_path>.\n";
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <port> <root_path> [--binary-log <dir>] [--admin].\n";
         return -1;
     }
 
+    std::string binaryLogDir;
+    for (int i = 3; i < argc; ++i) {
+        std::string_view option = argv[i];
+
+        if (option == "--binary-log" && i + 1 < argc) {
+            binaryLogDir = argv[++i];
+        }
+        else if (option == "--admin") {
+            adminEndpoints = true;
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " <port> <root_path> [--binary-log <dir>] [--admin].\n";
+            return -1;
+        }
+    }
+
     if (!fs::is_directory(argv[2])) {
         std::cerr << "init failed, given root_path: " << argv[2] << " is not a directory, this program won't work on that.";
         return -1;
     }
 
+#ifndef _WIN32
+    // a client closing early must not kill the server, send() reports EPIPE instead.
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
     try {
         auto port = static_cast<uint16_t>(std::stoi(argv[1]));
         HttpFileServer hfs;
 
+        if (!binaryLogDir.empty()) {
+            accessLogger.use_binary_log(binaryLogDir);
+        }
+
         hfs.serve("0.0.0.0", port, argv[2]);
     }
     catch (const std::invalid_argument& e) {
@@ -595,3 +3973,4 @@ int main(int argc, char* argv[]) {
 
     return 0;
 }
+#endif
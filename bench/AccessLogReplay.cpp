@@ -0,0 +1,427 @@
+/*
+    replays the access log of HttpFileServer against a server, to reproduce a production load locally.
+
+    the input is the text access log, as the server writes it to stdout. a binary log (--binary-log) is turned
+    into the same text by tools/AccessLogDecoder.cpp first, like: AccessLogDecoder access-*.hfslog | AccessLogReplay ... -
+
+    two steps:
+    1. --build-tree <dir> rebuilds a tree the log could have come from: every path served with a 200 becomes a file
+       of the largest size it was sent with, or a directory when it ends with '/' or other paths are under it.
+       files are sparse where the filesystem allows it. a listing only holds the entries the log saw, and paths
+       going up with "..", or that the platform can't name, are left out.
+    2. otherwise the requests are sent again, each one due at its logged time relative to the first one, divided
+       by --speed (0: all due at once, as fast as the connections go). requests are taken in order by
+       --connections threads, a request that is late because all of them are busy counts its latency from when
+       it was due, like the open loop of LoadGenerator. the logged durations are shown next to the replayed ones.
+
+    build: cl /std:c++20 /EHsc /O2 AccessLogReplay.cpp ws2_32.lib
+           g++ -std=c++20 -O2 -pthread AccessLogReplay.cpp -o AccessLogReplay
+    usage: AccessLogReplay --build-tree <dir> <log>...
+           AccessLogReplay [--host <ip>] [--port <port>] [--connections <n>] [--speed <x>] [--limit <n>] [--json <file>] <log>...
+    a log named "-" is stdin.
+*/
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <thread>
+#include <atomic>
+#include <format>
+#include <filesystem>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+
+#include "HttpLoad.h"
+
+namespace fs = std::filesystem;
+
+struct LoggedRequest {
+    int64_t timeUs;   // since epoch.
+    uint64_t durationUs;
+    uint64_t bytes;
+    uint16_t status;
+    std::string method;
+    std::string path;   // decoded, raw UTF-8.
+};
+
+struct Options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 8080;
+    unsigned connections = 64;
+    double speed = 1;
+    uint64_t limit = 0;
+    fs::path treeDir;
+    std::string jsonFile;
+    std::vector<std::string> logs;
+};
+
+static bool parse_number(std::string_view str, uint64_t& value) {
+    return std::from_chars(str.data(), str.data() + str.size(), value).ec == std::errc{};
+}
+
+// the value of " <key>=" up to the next space, empty if missing.
+static std::string_view field(std::string_view line, std::string_view key) {
+    auto pos = line.find(key);
+    if (pos == std::string_view::npos) {
+        return {};
+    }
+
+    auto value = line.substr(pos + key.size());
+    return value.substr(0, value.find(' '));
+}
+
+// like 2024-05-01T12:00:00.123456Z.
+static bool parse_time(std::string_view str, int64_t& timeUs) {
+    uint64_t y, mo, d, h, mi, s, us;
+    if (str.size() != 27 || !parse_number(str.substr(0, 4), y) || !parse_number(str.substr(5, 2), mo)
+        || !parse_number(str.substr(8, 2), d) || !parse_number(str.substr(11, 2), h) || !parse_number(str.substr(14, 2), mi)
+        || !parse_number(str.substr(17, 2), s) || !parse_number(str.substr(20, 6), us)) {
+        return false;
+    }
+
+    using namespace std::chrono;
+    sys_days days{ year{ static_cast<int>(y) } / month{ static_cast<unsigned>(mo) } / day{ static_cast<unsigned>(d) } };
+    auto time = days + hours{ h } + minutes{ mi } + seconds{ s } + microseconds{ us };
+    timeUs = duration_cast<microseconds>(time.time_since_epoch()).count();
+    return true;
+}
+
+// the path between the quotes, undoing the escapes of the server: \" \\ and \xNN.
+static bool parse_path(std::string_view line, std::string& path) {
+    auto pos = line.find(" path=\"");
+    if (pos == std::string_view::npos) {
+        return false;
+    }
+
+    path.clear();
+    for (pos += 7; pos < line.size(); ++pos) {
+        char c = line[pos];
+        if (c == '"') {
+            return true;
+        }
+        if (c != '\\' || pos + 1 >= line.size()) {
+            path += c;
+            continue;
+        }
+
+        char next = line[++pos];
+        uint8_t byte;
+        if (next == 'x' && pos + 2 < line.size() && std::from_chars(line.data() + pos + 1, line.data() + pos + 3, byte, 16).ec == std::errc{}) {
+            path += static_cast<char>(byte);
+            pos += 2;
+        }
+        else {
+            path += next;
+        }
+    }
+    return false;
+}
+
+static bool parse_line(std::string_view line, LoggedRequest& request) {
+    uint64_t status;
+    auto afterPath = line.rfind("\" status=");   // the path may hold anything, the fields after it are fixed.
+
+    if (!line.starts_with("time=") || afterPath == std::string_view::npos
+        || !parse_time(field(line, "time="), request.timeUs) || !parse_path(line, request.path)) {
+        return false;
+    }
+
+    auto tail = line.substr(afterPath);
+    request.method = field(line, " method=");
+    if (!parse_number(field(tail, " status="), status) || !parse_number(field(tail, " bytes="), request.bytes)
+        || !parse_number(field(tail, " duration_us="), request.durationUs)) {
+        return false;
+    }
+    request.status = static_cast<uint16_t>(status);
+    return true;
+}
+
+static bool read_logs(const std::vector<std::string>& logs, std::vector<LoggedRequest>& requests) {
+    uint64_t skipped = 0;
+
+    for (auto& log : logs) {
+        std::ifstream file;
+        if (log != "-") {
+            file.open(log, std::ios::binary);
+            if (!file) {
+                std::cerr << "error: cannot open " << log << "\n";
+                return false;
+            }
+        }
+        std::istream& in = log == "-" ? std::cin : file;
+
+        std::string line;
+        LoggedRequest request;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (parse_line(line, request)) {
+                requests.push_back(request);
+            }
+            else {
+                ++skipped;
+            }
+        }
+    }
+
+    // the flusher writes the rings of the threads one after another, so the lines are only roughly in order.
+    std::ranges::stable_sort(requests, {}, &LoggedRequest::timeUs);
+
+    if (skipped != 0) {
+        std::cerr << skipped << " lines that are not access log records skipped.\n";
+    }
+    return true;
+}
+
+// a path that stays inside the tree and that every platform can name, without the leading '/'.
+static bool tree_relative(std::string_view path, std::string& relative) {
+    if (!path.starts_with('/') || path.starts_with("/__")) {   // not a file of the root, or a page of the server.
+        return false;
+    }
+
+    relative = path.substr(1);
+    for (size_t begin = 0; begin <= relative.size();) {
+        auto end = std::min(relative.find('/', begin), relative.size());
+        auto segment = std::string_view{ relative }.substr(begin, end - begin);
+        if (segment == ".." || segment == "." || segment.find_first_of(":\\") != std::string_view::npos) {
+            return false;
+        }
+        begin = end + 1;
+    }
+    return true;
+}
+
+static void build_tree(const std::vector<LoggedRequest>& requests, const fs::path& root) {
+    std::set<std::string> dirs;
+    std::map<std::string, uint64_t> files;
+    std::string relative;
+
+    for (auto& request : requests) {
+        if (request.status != 200 || !tree_relative(request.path, relative)) {
+            continue;
+        }
+
+        if (relative.empty() || relative.ends_with('/')) {
+            dirs.insert(relative.substr(0, relative.size() - (relative.empty() ? 0 : 1)));
+        }
+        else {
+            auto& size = files[relative];
+            size = std::max(size, request.bytes);
+        }
+    }
+
+    for (auto& [file, size] : files) {
+        for (auto slash = file.find('/'); slash != std::string::npos; slash = file.find('/', slash + 1)) {
+            dirs.insert(file.substr(0, slash));
+        }
+    }
+
+    uint64_t fileCount = 0;
+    fs::create_directories(root);
+    for (auto& dir : dirs) {
+        fs::create_directories(root / fs::path(std::u8string(dir.begin(), dir.end())));
+    }
+    for (auto& [file, size] : files) {
+        if (dirs.contains(file)) {   // a listing requested without the trailing '/'.
+            continue;
+        }
+
+        auto path = root / fs::path(std::u8string(file.begin(), file.end()));
+        std::ofstream{ path, std::ios::binary };
+        fs::resize_file(path, size);
+        ++fileCount;
+    }
+
+    std::cerr << std::format("{}: {} directories, {} files\n", root.string(), dirs.size(), fileCount);
+}
+
+struct WorkerStats {
+    Histogram latency;   // from when the request was due.
+    Histogram service;   // from the send.
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint64_t bytes = 0;
+    uint64_t statusMismatches = 0;
+    uint64_t maxLagUs = 0;   // how late a request was sent.
+};
+
+static void run_worker(const Options& options, const std::vector<LoggedRequest>& requests, const sockaddr_in& addr,
+    std::atomic<size_t>& next, Clock::time_point start, WorkerStats& stats) {
+    auto firstUs = requests.front().timeUs;
+    HttpClient client;
+
+    for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < requests.size();) {
+        auto& request = requests[i];
+        auto due = start;
+        if (options.speed > 0) {
+            due += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::micro>((request.timeUs - firstUs) / options.speed));
+        }
+        std::this_thread::sleep_until(due);
+
+        auto message = std::format("GET {} HTTP/1.1\r\nHost: {}\r\nConnection: close\r\n\r\n", percent_encode(request.path), options.host);
+        if (request.method != "GET") {   // kept, the server answers it with a 405 like it did.
+            message = request.method + message.substr(3);
+        }
+
+        auto sent = Clock::now();
+        uint16_t status = 0;
+        uint64_t bytes = 0;
+        bool mustClose = true;
+        bool ok = client.open(addr) && client.send_all(message) && client.read_response(status, bytes, mustClose);
+        auto done = Clock::now();
+        client.close();
+
+        if (!ok) {
+            ++stats.errors;
+            continue;
+        }
+
+        ++stats.requests;
+        stats.bytes += bytes;
+        stats.statusMismatches += status != request.status;
+        stats.maxLagUs = std::max<uint64_t>(stats.maxLagUs, std::chrono::duration_cast<std::chrono::microseconds>(sent - due).count());
+        stats.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(done - due).count());
+        stats.service.record(std::chrono::duration_cast<std::chrono::nanoseconds>(done - sent).count());
+    }
+}
+
+static bool parse_options(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        try {
+            if (arg == "--host" && hasValue) {
+                options.host = argv[++i];
+            }
+            else if (arg == "--port" && hasValue) {
+                options.port = static_cast<uint16_t>(std::stoi(argv[++i]));
+            }
+            else if (arg == "--connections" && hasValue) {
+                options.connections = static_cast<unsigned>(std::max(1, std::stoi(argv[++i])));
+            }
+            else if (arg == "--speed" && hasValue) {
+                options.speed = std::max(0.0, std::stod(argv[++i]));
+            }
+            else if (arg == "--limit" && hasValue) {
+                options.limit = std::stoull(argv[++i]);
+            }
+            else if (arg == "--build-tree" && hasValue) {
+                options.treeDir = argv[++i];
+            }
+            else if (arg == "--json" && hasValue) {
+                options.jsonFile = argv[++i];
+            }
+            else if (arg == "-" || !arg.starts_with("--")) {
+                options.logs.emplace_back(arg);
+            }
+            else {
+                return false;
+            }
+        }
+        catch (const std::exception&) {   // std::stoi, std::stod.
+            return false;
+        }
+    }
+
+    return !options.logs.empty();
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " --build-tree <dir> <log>...\n"
+            << "       " << argv[0] << " [--host <ip>] [--port <port>] [--connections <n>] [--speed <x>] [--limit <n>] [--json <file>] <log>...\n";
+        return -1;
+    }
+
+    std::vector<LoggedRequest> requests;
+    if (!read_logs(options.logs, requests)) {
+        return -1;
+    }
+    if (requests.empty()) {
+        std::cerr << "error: no access log records.\n";
+        return -1;
+    }
+    if (options.limit != 0 && requests.size() > options.limit) {
+        requests.resize(options.limit);
+    }
+
+    if (!options.treeDir.empty()) {
+        try {
+            build_tree(requests, options.treeDir);
+        }
+        catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            return -1;
+        }
+        return 0;
+    }
+
+    sockaddr_in addr;
+    if (!net_startup(options.host, options.port, addr)) {
+        return -1;
+    }
+
+    std::vector<WorkerStats> stats(options.connections);
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next{ 0 };
+    auto start = Clock::now() + std::chrono::milliseconds{ 50 };   // once every thread is up.
+
+    for (unsigned i = 0; i < options.connections; ++i) {
+        workers.emplace_back(run_worker, std::cref(options), std::cref(requests), std::cref(addr), std::ref(next), start, std::ref(stats[i]));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    auto wallSec = std::chrono::duration<double>(Clock::now() - start).count();
+
+    WorkerStats total;
+    Histogram logged;
+    for (auto& s : stats) {
+        total.latency.merge(s.latency);
+        total.service.merge(s.service);
+        total.requests += s.requests;
+        total.errors += s.errors;
+        total.bytes += s.bytes;
+        total.statusMismatches += s.statusMismatches;
+        total.maxLagUs = std::max(total.maxLagUs, s.maxLagUs);
+    }
+    for (auto& request : requests) {
+        logged.record(request.durationUs * 1000);
+    }
+
+    auto logSec = (requests.back().timeUs - requests.front().timeUs) / 1e6;
+    std::string out = std::format("{} logged requests over {:.3f}s, replayed at {} in {:.3f}s with {} connections\n",
+        requests.size(), logSec, options.speed > 0 ? std::format("{}x", options.speed) : "full speed", wallSec, options.connections);
+    out += std::format("requests {}, {:.1f}/s, errors {}, status differing from the log {}, {:.2f} MiB/s, latest start {:.3f}ms\n",
+        total.requests, total.requests / wallSec, total.errors, total.statusMismatches, total.bytes / wallSec / (1024 * 1024), total.maxLagUs / 1000.0);
+    append_quantiles_text(out, "latency from due time", total.latency);
+    append_quantiles_text(out, "service time", total.service);
+    append_quantiles_text(out, "logged duration", logged);
+    std::cout << out;
+
+    if (!options.jsonFile.empty()) {
+        auto json = std::format("{{\n  \"mode\": \"replay\",\n  \"speed\": {},\n  \"connections\": {},\n  \"duration_s\": {:.3f},\n"
+            "  \"requests\": {},\n  \"errors\": {},\n  \"status_mismatches\": {},\n  \"bytes\": {},\n  \"throughput_rps\": {:.3f},\n",
+            options.speed, options.connections, wallSec, total.requests, total.errors, total.statusMismatches, total.bytes, total.requests / wallSec);
+        append_quantiles_json(json, "latency_us", total.latency, false);
+        append_quantiles_json(json, "service_us", total.service, false);
+        append_quantiles_json(json, "logged_us", logged, true);
+        json += "}\n";
+
+        if (options.jsonFile == "-") {
+            std::cout << json;
+        }
+        else if (!(std::ofstream{ options.jsonFile } << json)) {
+            std::cerr << "error: cannot write " << options.jsonFile << "\n";
+            return -1;
+        }
+    }
+
+    return total.errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+/*
+    checks of whole requests through HttpConnection over a MemoryTransport, the server file is included as is.
+    a small tree is made in the temp directory, every request runs on a connection of its own like on the server,
+    and the status line, headers and body of the response are compared with what they must be. SpaceSaving, the
+    summary behind /__top, is checked on its own against exact counts. a failed check is printed, and the exit
+    code is not 0.
+
+    build: cl /std:c++20 /EHsc /O2 /I.. ConnectionTest.cpp ws2_32.lib
+           g++ -std=c++20 -O2 -pthread -I.. ConnectionTest.cpp -o ConnectionTest
+    usage: ConnectionTest
+*/
+#define HFS_NO_MAIN
+#include "HttpFileServer.cpp"
+
+#include <random>
+#include <set>
+
+// the server's connection, over a MemoryTransport that keeps the response.
+using MemoryConnection = BasicHttpConnection<MemoryTransport, StreamFileSource, SharedDirCache, RingAccessLogger>;
+
+static int checks = 0;
+static int failures = 0;
+
+static void check(bool ok, std::string_view what) {
+    ++checks;
+    if (!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+struct Response {
+    std::string statusLine;
+    std::string head;   // the header lines after the status line, each ending with "\r\n".
+    std::string body;
+    size_t count = 0;   // responses in what was sent, by their status lines.
+
+    // the value of header <name>, empty if there is none.
+    std::string_view header(std::string_view name) const {
+        std::string_view rest = head;
+        while (!rest.empty()) {
+            auto end = rest.find("\r\n");
+            auto line = rest.substr(0, end);
+            if (line.size() > name.size() && line.starts_with(name) && line.substr(name.size(), 2) == ": ") {
+                return line.substr(name.size() + 2);
+            }
+            rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 2);
+        }
+        return {};
+    }
+
+    static Response of(std::string_view sent) {
+        Response response;
+        for (auto pos = sent.find("HTTP/1.1 "); pos != std::string_view::npos; pos = sent.find("\r\nHTTP/1.1 ", pos + 1)) {
+            ++response.count;
+        }
+
+        auto lineEnd = sent.find("\r\n");
+        auto headEnd = sent.find("\r\n\r\n");
+        if (lineEnd == std::string_view::npos || headEnd == std::string_view::npos) {
+            response.statusLine = sent;
+            return response;
+        }
+
+        response.statusLine = sent.substr(0, lineEnd);
+        response.head = sent.substr(lineEnd + 2, headEnd + 2 - (lineEnd + 2));
+        response.body = sent.substr(headEnd + 4);
+        return response;
+    }
+};
+
+class ConnectionTest {
+    fs::path base;   // the root and a file next to it, which must not be reachable.
+    fs::path root;
+    native_string rootPath;
+    sockaddr_storage local{};
+    sockaddr_storage remote{};
+
+    static void write_file(const fs::path& p, std::string_view content) {
+        std::ofstream{ p, std::ios::binary } << content;
+    }
+public:
+    ConnectionTest() {
+        base = fs::temp_directory_path() / std::format("hfs-connectiontest-{}", std::chrono::steady_clock::now().time_since_epoch().count());
+        root = base / "root";
+        fs::create_directories(root / "dir");
+        write_file(base / "secret.txt", "secret\n");
+        write_file(root / "hello.txt", "hello\n");
+        write_file(root / "page.html", "<p>page</p>");
+        write_file(root / "a b#c.txt", "abc");
+        write_file(root / "dir" / "a.txt", "a");
+        write_file(root / "dir" / "it's.txt", "it");
+#ifndef _WIN32
+        write_file(root / "dir" / "javascript:alert(1)", "js");   // ':' can't be in a name on windows.
+#endif
+        rootPath = root.native();
+
+        auto& local4 = reinterpret_cast<sockaddr_in&>(local);
+        local4.sin_family = AF_INET;
+        local4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        auto& remote4 = reinterpret_cast<sockaddr_in&>(remote);
+        remote4.sin_family = AF_INET;
+        remote4.sin_addr.s_addr = htonl(0xc0000201);   // 192.0.2.1, a documentation address.
+    }
+
+    ~ConnectionTest() {
+        std::error_code ec;
+        fs::remove_all(base, ec);
+    }
+
+    Response run(std::string_view request, bool fromLocal = false) {
+        MemoryConnection connection{ MemoryTransport{ request }, fromLocal ? local : remote, rootPath };
+        connection.start();
+        return Response::of(connection.get_transport().response());
+    }
+
+    Response get(std::string_view uri, bool fromLocal = false) {
+        return run(std::format("GET {} HTTP/1.1\r\nHost: localhost\r\n\r\n", uri), fromLocal);
+    }
+
+    Response post(std::string_view uri, bool fromLocal = false) {
+        return run(std::format("POST {} HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\n\r\n", uri), fromLocal);
+    }
+
+    void test_file() {
+        auto r = get("/hello.txt");
+        check(r.count == 1, "file: one response");
+        check(r.statusLine == "HTTP/1.1 200 OK", "file: status line");
+        check(r.header("Server") == "Miku Server", "file: Server");
+        check(r.header("Connection") == "close", "file: Connection");
+        check(r.header("Content-Type") == "text/plain", "file: Content-Type");
+        check(r.header("Content-Length") == "6", "file: Content-Length");
+        check(r.header("Date").ends_with(" GMT"), "file: Date");
+        check(r.header("ETag").starts_with("W/\"") && r.header("ETag").ends_with("-6\""), "file: weak ETag of mtime and size");
+        check(r.body == "hello\n", "file: body");
+
+        r = get("/page.html");
+        check(r.statusLine == "HTTP/1.1 200 OK", "html: status line");
+        check(r.header("Content-Type") == "text/html", "html: Content-Type");
+        check(r.body == "<p>page</p>", "html: body");
+
+        r = get("/a%20b%23c.txt");
+        check(r.statusLine == "HTTP/1.1 200 OK" && r.body == "abc", "file: percent-encoded name");
+    }
+
+    void test_listing() {
+        auto r = get("/dir/");
+        check(r.count == 1, "listing: one response");
+        check(r.statusLine == "HTTP/1.1 200 OK", "listing: status line");
+        check(r.header("Content-Type") == "text/html; charset=utf-8", "listing: Content-Type");
+        check(r.header("Content-Length") == std::to_string(r.body.size()), "listing: Content-Length");
+        check(r.body.starts_with("<html>") && r.body.ends_with("</html>"), "listing: html");
+        check(r.body.find("<a href='a.txt'>a.txt</a>") != std::string::npos, "listing: plain name");
+        check(r.body.find("<a href='it%27s.txt'>it&#39;s.txt</a>") != std::string::npos, "listing: quote escaped");
+#ifndef _WIN32
+        check(r.body.find("href='javascript%3Aalert(1)'") != std::string::npos, "listing: ':' encoded in the link");
+        check(r.body.find("href='javascript:") == std::string::npos, "listing: no javascript: link");
+#endif
+    }
+
+    void test_not_found() {
+        auto r = get("/missing.txt");
+        check(r.count == 1, "404: one response");
+        check(r.statusLine == "HTTP/1.1 404 Not Found", "404: status line");
+        check(r.header("Content-Type") == "text/html", "404: Content-Type");
+        check(r.header("Content-Length") == std::to_string(r.body.size()), "404: Content-Length");
+        check(r.body == "<html><h1>Not Found</h1></html>", "404: body");
+
+        r = post("/hello.txt");
+        check(r.statusLine == "HTTP/1.1 405 Method Not Allowd", "405: POST of a file");
+
+        r = run("PUT /hello.txt HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        check(r.statusLine == "HTTP/1.1 405 Method Not Allowd", "405: PUT");
+    }
+
+    void test_traversal() {
+        for (std::string_view uri : { "/../secret.txt", "/%2e%2e/secret.txt", "/%2E%2e/secret.txt", "/dir/../../secret.txt",
+                                      "/dir/%2e%2e/%2e%2e/secret.txt", "/./hello.txt", "/dir/../hello.txt", "/hello.txt%00.png" }) {
+            auto r = get(uri);
+            check(r.statusLine == "HTTP/1.1 404 Not Found" && r.body.find("secret") == std::string::npos, std::format("traversal: {} is 404", uri));
+        }
+    }
+
+    // the server answers one request per connection, so a pipelined second request is not answered.
+    void test_pipelining() {
+        auto r = run("GET /hello.txt HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+                     "GET /dir/a.txt HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n");
+        check(r.count == 1, "pipelining: only the first request is answered");
+        check(r.statusLine == "HTTP/1.1 200 OK" && r.body == "hello\n", "pipelining: the first response");
+        check(r.header("Connection") == "close", "pipelining: the connection is closed after it");
+    }
+
+    void test_admin() {
+        check(get("/__metrics").statusLine == "HTTP/1.1 200 OK", "admin: /__metrics is always served");
+
+        for (std::string_view uri : { "/__top", "/__connections", "/__trace" }) {
+            check(get(uri, true).statusLine == "HTTP/1.1 404 Not Found", std::format("admin: {} off by default", uri));
+        }
+        check(post("/__trace/on", true).statusLine == "HTTP/1.1 405 Method Not Allowd", "admin: no switch by default");
+        check(!tracer.enabled(), "admin: tracing stays off");
+
+        adminEndpoints = true;
+        for (std::string_view uri : { "/__top", "/__connections", "/__trace" }) {
+            check(get(uri, true).statusLine == "HTTP/1.1 200 OK", std::format("admin: {} for a loopback client", uri));
+            check(get(uri).statusLine == "HTTP/1.1 404 Not Found", std::format("admin: {} not for another client", uri));
+        }
+
+        check(get("/__trace/on", true).statusLine == "HTTP/1.1 405 Method Not Allowd", "admin: GET doesn't switch tracing");
+        check(!tracer.enabled(), "admin: tracing still off");
+
+        auto r = post("/__trace/on", true);
+        check(r.statusLine == "HTTP/1.1 200 OK" && r.body == "tracing on\n" && tracer.enabled(), "admin: POST switches tracing on");
+        r = post("/__trace/off", true);
+        check(r.statusLine == "HTTP/1.1 200 OK" && r.body == "tracing off\n" && !tracer.enabled(), "admin: POST switches tracing off");
+        adminEndpoints = false;
+    }
+
+    // a path is written escaped like in the access log, so it can't add rows of its own.
+    void test_top() {
+        for (int i = 0; i < 4; ++i) {   // more than once, in case a window ends in between and halves the count.
+            get("/forged%0a%20%20count=999%20error=0%20/x%22");
+        }
+
+        adminEndpoints = true;
+        auto r = get("/__top", true);
+        adminEndpoints = false;
+
+        check(r.statusLine == "HTTP/1.1 200 OK", "top: served");
+        check(r.body.find("\n  count=999") == std::string::npos, "top: no row made up by a path");
+        check(r.body.find("/forged\\x0a  count=999 error=0 /x\\\"") != std::string::npos, "top: the path escaped");
+    }
+};
+
+static void test_space_saving() {
+    // a skewed stream: half of it on 8 keys, the rest spread over 500. the engine gives the same numbers on every
+    // platform, unlike the distributions.
+    constexpr uint64_t TOTAL = 20000;
+    SpaceSaving summary;
+    std::map<std::string, uint64_t> exact;
+    std::mt19937_64 rng{ 0x5eed };
+
+    for (uint64_t i = 0; i < TOTAL; ++i) {
+        auto r = rng();
+        auto key = std::format("/k{}", r % 2 == 0 ? (r >> 1) % 8 : (r >> 1) % 500);
+        summary.count(key, 0);
+        ++exact[key];
+    }
+
+    std::vector<SpaceSaving::Entry> entries;
+    summary.snapshot(entries, 0);
+
+    std::set<std::string> kept;
+    bool bounded = true;
+    for (auto& entry : entries) {
+        kept.insert(entry.key);
+        auto iter = exact.find(entry.key);
+        auto n = iter == exact.end() ? 0 : iter->second;
+        bounded = bounded && entry.error <= entry.count && entry.count - entry.error <= n && n <= entry.count;
+    }
+    check(entries.size() == HTTP_HEAVY_HITTERS, "space saving: every slot used");
+    check(kept.size() == entries.size(), "space saving: no key twice");
+    check(bounded, "space saving: count - error <= true count <= count");
+
+    for (auto& [key, n] : exact) {   // at most TOTAL / HTTP_HEAVY_HITTERS is ever evicted.
+        if (n > TOTAL / HTTP_HEAVY_HITTERS) {
+            check(kept.contains(key), std::format("space saving: {} ({} of {}) kept", key, n, TOTAL));
+        }
+    }
+
+    // a new key takes the smallest slot, with its count as the error.
+    SpaceSaving full;
+    for (size_t i = 0; i < HTTP_HEAVY_HITTERS; ++i) {
+        full.count(std::format("/{}", i), 0);
+        full.count(std::format("/{}", i), 0);
+    }
+    full.count("/new", 0);
+    entries.clear();
+    full.snapshot(entries, 0);
+    auto added = std::ranges::find(entries, std::string{ "/new" }, &SpaceSaving::Entry::key);
+    check(added != entries.end() && added->count == 3 && added->error == 2, "space saving: a new key over the smallest slot");
+
+    // the counts halve every window, when read and when the owner counts again.
+    SpaceSaving decaying;
+    for (int i = 0; i < 8; ++i) {
+        decaying.count("/a", 0);
+    }
+
+    auto count_at = [&](uint64_t now) {
+        entries.clear();
+        decaying.snapshot(entries, now);
+        return entries.empty() ? 0 : entries[0].count;
+    };
+    check(count_at(0) == 8, "space saving: no decay in the window");
+    check(count_at(1) == 4, "space saving: halved after a window");
+    check(count_at(3) == 1, "space saving: halved every window");
+    check(count_at(4) == 0 && entries.empty(), "space saving: gone once decayed to 0");
+
+    decaying.count("/a", 2);
+    check(count_at(2) == 3, "space saving: the owner decays before counting");
+    check(count_at(3) == 1, "space saving: read after the owner decayed");
+}
+
+int main() {
+    accessLogger.discard(true);
+
+    try {
+        ConnectionTest test;
+        test.test_file();
+        test.test_listing();
+        test.test_not_found();
+        test.test_traversal();
+        test.test_pipelining();
+        test.test_admin();
+        test.test_top();
+        test_space_saving();
+    }
+    catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
+
+    std::cout << std::format("{} checks, {} failed\n", checks, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,291 @@
+/*
+* Pieces shared by the load tools in bench/: a blocking HTTP/1.1 client, a latency histogram, and the way
+* they print it. header only, like BinaryAccessLog.h, every tool stays a single file to build.
+*/
+#pragma once
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <csignal>
+#endif
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <format>
+#include <algorithm>
+#include <charconv>
+#include <bit>
+#include <cctype>
+#include <cstdint>
+
+#ifndef _WIN32
+using SOCKET = int;
+constexpr SOCKET INVALID_SOCKET = -1;
+
+inline int closesocket(SOCKET sock) {
+    return close(sock);
+}
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t RECV_TIMEOUT_SEC = 10;
+constexpr size_t RECV_BUFFER_LEN = 64 * 1024;
+
+/*
+    log-linear histogram of nanoseconds, like HdrHistogram with 2 significant digits: values below 2^SUB_BITS
+    are exact, above it each power of two is split in 2^SUB_BITS buckets, so a bucket is off by less than 1%.
+*/
+class Histogram {
+    static constexpr unsigned SUB_BITS = 7;
+    static constexpr uint64_t SUB_COUNT = uint64_t{ 1 } << SUB_BITS;
+    static constexpr uint64_t MAX_NS = (uint64_t{ 1 } << 42) - 1;   // over an hour.
+    static constexpr size_t BUCKETS = (42 - SUB_BITS + 1) * SUB_COUNT;
+
+    std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKETS);
+    uint64_t total = 0;
+    uint64_t sumNs = 0;
+    uint64_t maxNs = 0;
+
+    static size_t bucket_index(uint64_t ns) noexcept {
+        if (ns < SUB_COUNT) {
+            return static_cast<size_t>(ns);
+        }
+
+        auto shift = static_cast<unsigned>(std::bit_width(ns)) - 1 - SUB_BITS;
+        return static_cast<size_t>((shift + 1) * SUB_COUNT + ((ns >> shift) - SUB_COUNT));
+    }
+
+    static uint64_t bucket_upper(size_t index) noexcept {
+        auto group = index / SUB_COUNT;
+        if (group == 0) {
+            return index;
+        }
+
+        auto shift = group - 1;
+        return ((SUB_COUNT + index % SUB_COUNT) << shift) + (uint64_t{ 1 } << shift) - 1;
+    }
+public:
+    void record(uint64_t ns) noexcept {
+        ns = std::min(ns, MAX_NS);
+        ++counts[bucket_index(ns)];
+        ++total;
+        sumNs += ns;
+        maxNs = std::max(maxNs, ns);
+    }
+
+    void merge(const Histogram& other) noexcept {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sumNs += other.sumNs;
+        maxNs = std::max(maxNs, other.maxNs);
+    }
+
+    uint64_t count() const noexcept {
+        return total;
+    }
+
+    uint64_t max() const noexcept {
+        return maxNs;
+    }
+
+    uint64_t mean() const noexcept {
+        return total == 0 ? 0 : sumNs / total;
+    }
+
+    // the upper bound of the bucket holding the <q> quantile, capped by the largest value seen.
+    uint64_t quantile(double q) const noexcept {
+        auto rank = static_cast<uint64_t>(q * static_cast<double>(total) + 0.5);
+        rank = std::clamp<uint64_t>(rank, 1, std::max<uint64_t>(total, 1));
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(bucket_upper(i), maxNs);
+            }
+        }
+        return maxNs;
+    }
+};
+
+constexpr std::array<std::pair<std::string_view, double>, 6> QUANTILES{ {
+    { "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "p99_9", 0.999 }, { "p99_99", 0.9999 }, { "p100", 1.0 }
+} };
+
+// like "latency (us): p50 12.3 ... mean 15.0".
+inline void append_quantiles_text(std::string& out, std::string_view title, const Histogram& histogram) {
+    out += std::format("{} (us):", title);
+    for (auto& [name, q] : QUANTILES) {
+        out += std::format(" {} {:.1f}", name, histogram.quantile(q) / 1000.0);
+    }
+    out += std::format(" mean {:.1f}\n", histogram.mean() / 1000.0);
+}
+
+// like  "latency_us": { "p50": 12.3, ..., "mean": 15.0 }, in microseconds.
+inline void append_quantiles_json(std::string& out, std::string_view name, const Histogram& histogram, bool last) {
+    out += std::format("  \"{}\": {{", name);
+    for (auto& [quantile, q] : QUANTILES) {
+        out += std::format(" \"{}\": {:.1f},", quantile, histogram.quantile(q) / 1000.0);
+    }
+    out += std::format(" \"mean\": {:.1f} }}{}\n", histogram.mean() / 1000.0, last ? "" : ",");
+}
+
+// everything but the unreserved characters and '/' is percent-encoded, the server decodes them back.
+inline std::string percent_encode(std::string_view path) {
+    std::string out;
+    for (unsigned char c : path) {
+        if (std::isalnum(c) || c == '/' || c == '-' || c == '.' || c == '_' || c == '~') {
+            out += static_cast<char>(c);
+        }
+        else {
+            out += std::format("%{:02X}", c);
+        }
+    }
+    return out;
+}
+
+// winsock, or ignoring SIGPIPE so a server closing early is an error of send(), then the address.
+inline bool net_startup(const std::string& host, uint16_t port, sockaddr_in& addr) {
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        std::cerr << "error WSAStartup()\n";
+        return false;
+    }
+#else
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+    addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "error: " << host << " is not an IPv4 address.\n";
+        return false;
+    }
+    return true;
+}
+
+/*
+    one client connection, blocking, a request at a time.
+*/
+class HttpClient {
+    SOCKET sock = INVALID_SOCKET;
+    std::vector<char> buffer = std::vector<char>(RECV_BUFFER_LEN);
+public:
+    HttpClient() = default;
+    HttpClient(const HttpClient&) = delete;
+
+    ~HttpClient() {
+        close();
+    }
+
+    bool is_open() const noexcept {
+        return sock != INVALID_SOCKET;
+    }
+
+    void close() noexcept {
+        if (sock != INVALID_SOCKET) {
+            closesocket(sock);
+            sock = INVALID_SOCKET;
+        }
+    }
+
+    bool open(const sockaddr_in& addr) {
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock == INVALID_SOCKET) {
+            return false;
+        }
+
+#ifdef _WIN32
+        uint32_t recvTimeOut = RECV_TIMEOUT_SEC * 1000;
+#else
+        timeval recvTimeOut{ RECV_TIMEOUT_SEC, 0 };
+#endif
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&recvTimeOut), sizeof(recvTimeOut));
+
+        if (connect(sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    bool send_all(std::string_view data) {
+        while (!data.empty()) {
+            auto len = send(sock, data.data(), static_cast<int>(data.size()), 0);
+            if (len <= 0) {
+                return false;
+            }
+            data.remove_prefix(static_cast<size_t>(len));
+        }
+        return true;
+    }
+
+    /*
+        reads a whole response, the body by its Content-Length, or up to the end of the connection without one.
+        returns false on an error or a malformed response, sets <mustClose> if the connection can't be reused.
+    */
+    bool read_response(uint16_t& status, uint64_t& bytes, bool& mustClose) {
+        std::string header;
+        size_t headerEnd;
+
+        while ((headerEnd = header.find("\r\n\r\n")) == std::string::npos) {
+            auto len = recv(sock, buffer.data(), static_cast<int>(buffer.size()), 0);
+            if (len <= 0 || header.size() > 64 * 1024) {
+                return false;
+            }
+            header.append(buffer.data(), static_cast<size_t>(len));
+        }
+
+        if (!header.starts_with("HTTP/1.") || header.size() < 12
+            || std::from_chars(header.data() + 9, header.data() + 12, status).ec != std::errc{}) {
+            return false;
+        }
+
+        std::string lower(header.begin(), header.begin() + headerEnd);
+        std::ranges::transform(lower, lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        uint64_t contentLength = 0;
+        auto lengthPos = lower.find("\r\ncontent-length:");
+        bool hasLength = lengthPos != std::string::npos;
+        if (hasLength) {
+            auto pos = lengthPos + 17;
+            while (pos < lower.size() && lower[pos] == ' ') {
+                ++pos;
+            }
+            hasLength = std::from_chars(lower.data() + pos, lower.data() + lower.size(), contentLength).ec == std::errc{};
+        }
+        mustClose = !hasLength || lower.find("\r\nconnection: close") != std::string::npos;
+
+        auto received = static_cast<uint64_t>(header.size() - headerEnd - 4);
+        while (!hasLength || received < contentLength) {
+            auto len = recv(sock, buffer.data(), static_cast<int>(buffer.size()), 0);
+            if (len == 0 && !hasLength) {
+                break;
+            }
+            if (len <= 0) {
+                return false;
+            }
+            received += static_cast<uint64_t>(len);
+        }
+
+        bytes = headerEnd + 4 + received;
+        return true;
+    }
+};
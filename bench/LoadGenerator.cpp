@@ -0,0 +1,374 @@
+/*
+    load generator for HttpFileServer, drives it over loopback (or any host) with a mix of requests and reports
+    the latency distribution and the throughput, so two builds or two settings can be compared.
+
+    every connection is a thread doing one request at a time, like the server serves them.
+    closed loop (the default): a connection sends its next request as soon as the previous one is done, so the
+    server sets the pace, and a stall of the server also stalls the requests that would have come meanwhile.
+    open loop (--rate): requests are due at a constant rate, spread over the connections, whatever the server
+    does. a request that could not start on time because its connection was still busy counts its latency from
+    when it was due, not from when it was sent, which corrects the coordinated omission of the closed loop, the
+    time from the send is reported apart as the service time.
+
+    the mix file has a line per path, "<class> <path>", the classes are small, large, listing and missing,
+    a path is raw UTF-8, percent-encoded when sent, '#' starts a comment line. a request first picks a class by
+    its weight, then a path of that class.
+
+    build: cl /std:c++20 /EHsc /O2 LoadGenerator.cpp ws2_32.lib
+           g++ -std=c++20 -O2 -pthread LoadGenerator.cpp -o LoadGenerator
+    usage: LoadGenerator [--host <ip>] [--port <port>] [--connections <n>] [--duration <sec>] [--warmup <sec>]
+                         [--rate <requests/sec>] [--keep-alive] [--weights small=60,large=5,listing=15,missing=20]
+                         [--json <file>] <mix file>
+*/
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <thread>
+#include <random>
+#include <format>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+
+#include "HttpLoad.h"
+
+enum RequestClass : size_t {
+    CLASS_SMALL,
+    CLASS_LARGE,
+    CLASS_LISTING,
+    CLASS_MISSING,
+    CLASS_COUNT
+};
+
+constexpr std::array<std::string_view, CLASS_COUNT> CLASS_NAMES{ "small", "large", "listing", "missing" };
+
+struct Options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 8080;
+    unsigned connections = 16;
+    double durationSec = 10;
+    double warmupSec = 1;
+    double rate = 0;   // requests per second of all the connections, 0 for a closed loop.
+    bool keepAlive = false;
+    std::array<unsigned, CLASS_COUNT> weights{ 60, 5, 15, 20 };
+    std::string jsonFile;
+    std::string mixFile;
+};
+
+struct Mix {
+    std::array<std::vector<std::string>, CLASS_COUNT> targets;   // request targets, already percent-encoded.
+    std::discrete_distribution<size_t> classes;
+};
+
+struct WorkerStats {
+    Histogram latency;   // from when the request was due.
+    Histogram service;   // from the send.
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint64_t connects = 0;
+    uint64_t bytes = 0;   // of the responses, header included.
+    std::array<uint64_t, CLASS_COUNT> byClass{};
+    std::array<uint64_t, 6> byStatus{};   // by the first digit of the status code, 0 for anything else.
+};
+
+static bool load_mix(const Options& options, Mix& mix) {
+    std::ifstream in{ options.mixFile };
+    if (!in) {
+        std::cerr << "error: cannot open " << options.mixFile << "\n";
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        auto space = line.find(' ');
+        auto iter = std::ranges::find(CLASS_NAMES, std::string_view{ line }.substr(0, space));
+        if (space == std::string::npos || iter == CLASS_NAMES.end()) {
+            std::cerr << "error: bad mix line: " << line << "\n";
+            return false;
+        }
+
+        mix.targets[iter - CLASS_NAMES.begin()].push_back(percent_encode(std::string_view{ line }.substr(space + 1)));
+    }
+
+    std::array<double, CLASS_COUNT> weights{};
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        weights[i] = mix.targets[i].empty() ? 0 : options.weights[i];
+    }
+
+    if (std::ranges::all_of(weights, [](double w) { return w == 0; })) {
+        std::cerr << "error: no class of the mix has both a weight and a path.\n";
+        return false;
+    }
+
+    mix.classes = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    return true;
+}
+
+static void run_worker(const Options& options, const Mix& mix, const sockaddr_in& addr, unsigned index,
+    Clock::time_point start, WorkerStats& stats) {
+    auto measureBegin = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.warmupSec));
+    auto end = measureBegin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.durationSec));
+
+    std::mt19937_64 rng{ 0x5eed0000u + index };   // the same sequence of requests on every run.
+    auto classes = mix.classes;
+    HttpClient connection;
+
+    for (uint64_t k = 0;; ++k) {
+        auto due = Clock::now();
+        if (options.rate > 0) {   // the k-th request of this connection, the connections take turns.
+            auto seconds = static_cast<double>(k * options.connections + index) / options.rate;
+            due = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+            std::this_thread::sleep_until(due);
+        }
+        if (due >= end) {
+            break;
+        }
+
+        auto requestClass = classes(rng);
+        auto& targets = mix.targets[requestClass];
+        auto& target = targets[std::uniform_int_distribution<size_t>(0, targets.size() - 1)(rng)];
+        auto request = std::format("GET {} HTTP/1.1\r\nHost: {}\r\nConnection: {}\r\n\r\n",
+            target, options.host, options.keepAlive ? "keep-alive" : "close");
+
+        auto sent = Clock::now();
+        uint16_t status = 0;
+        uint64_t bytes = 0;
+        bool mustClose = true;
+        bool reused = connection.is_open();
+        uint64_t connects = reused ? 0 : 1;
+
+        bool ok = (reused || connection.open(addr))
+            && connection.send_all(request)
+            && connection.read_response(status, bytes, mustClose);
+
+        if (!ok && reused) {   // the server may close an idle connection at any time, retry once on a new one.
+            connection.close();
+            ++connects;
+            ok = connection.open(addr) && connection.send_all(request) && connection.read_response(status, bytes, mustClose);
+        }
+        auto done = Clock::now();
+
+        if (!ok || mustClose || !options.keepAlive) {
+            connection.close();
+        }
+
+        if (due < measureBegin) {
+            continue;
+        }
+
+        stats.connects += connects;
+        if (!ok) {
+            ++stats.errors;
+            continue;
+        }
+
+        ++stats.requests;
+        ++stats.byClass[requestClass];
+        ++stats.byStatus[status >= 100 && status < 600 ? status / 100 : 0];
+        stats.bytes += bytes;
+        stats.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(done - due).count());
+        stats.service.record(std::chrono::duration_cast<std::chrono::nanoseconds>(done - sent).count());
+    }
+}
+
+static std::string format_text(const Options& options, const WorkerStats& total) {
+    std::string out;
+    auto seconds = options.durationSec;
+
+    if (options.rate > 0) {
+        out += std::format("open loop at {} requests/s, ", options.rate);
+    }
+    else {
+        out += "closed loop, ";
+    }
+    out += std::format("{} connections, keep-alive {}, {}s after a {}s warmup\n",
+        options.connections, options.keepAlive ? "on" : "off", options.durationSec, options.warmupSec);
+
+    out += std::format("requests {}, {:.1f}/s, errors {}, connects {}, {:.2f} MiB/s\n",
+        total.requests, total.requests / seconds, total.errors, total.connects, total.bytes / seconds / (1024 * 1024));
+
+    out += "classes:";
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        out += std::format(" {} {}", CLASS_NAMES[i], total.byClass[i]);
+    }
+    out += "\nstatus:";
+    for (size_t i = 1; i < total.byStatus.size(); ++i) {
+        if (total.byStatus[i] != 0) {
+            out += std::format(" {}xx {}", i, total.byStatus[i]);
+        }
+    }
+    if (total.byStatus[0] != 0) {
+        out += std::format(" other {}", total.byStatus[0]);
+    }
+    out += "\n";
+
+    if (options.rate > 0) {
+        append_quantiles_text(out, "latency from due time", total.latency);
+        append_quantiles_text(out, "service time", total.service);
+    }
+    else {
+        append_quantiles_text(out, "latency", total.service);
+    }
+
+    return out;
+}
+
+static std::string format_json(const Options& options, const WorkerStats& total) {
+    auto seconds = options.durationSec;
+    std::string out = "{\n";
+
+    out += std::format("  \"mode\": \"{}\",\n  \"rate\": {},\n  \"connections\": {},\n  \"keep_alive\": {},\n  \"duration_s\": {},\n",
+        options.rate > 0 ? "open" : "closed", options.rate, options.connections, options.keepAlive, options.durationSec);
+    out += std::format("  \"requests\": {},\n  \"errors\": {},\n  \"connects\": {},\n  \"bytes\": {},\n  \"throughput_rps\": {:.3f},\n",
+        total.requests, total.errors, total.connects, total.bytes, total.requests / seconds);
+
+    out += "  \"classes\": {";
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        out += std::format("{}\"{}\": {}", i == 0 ? " " : ", ", CLASS_NAMES[i], total.byClass[i]);
+    }
+    out += " },\n";
+
+    // in a closed loop a request is due when it is sent, both are the same.
+    append_quantiles_json(out, "latency_us", options.rate > 0 ? total.latency : total.service, false);
+    append_quantiles_json(out, "service_us", total.service, true);
+
+    out += "}\n";
+    return out;
+}
+
+static bool parse_weights(std::string_view list, std::array<unsigned, CLASS_COUNT>& weights) {
+    weights.fill(0);
+
+    while (!list.empty()) {
+        auto item = list.substr(0, list.find(','));
+        list.remove_prefix(std::min(list.size(), item.size() + 1));
+
+        auto eq = item.find('=');
+        auto iter = std::ranges::find(CLASS_NAMES, item.substr(0, eq));
+        if (eq == std::string_view::npos || iter == CLASS_NAMES.end()
+            || std::from_chars(item.data() + eq + 1, item.data() + item.size(), weights[iter - CLASS_NAMES.begin()]).ec != std::errc{}) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parse_options(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        try {
+            if (arg == "--keep-alive") {
+                options.keepAlive = true;
+            }
+            else if (arg == "--host" && hasValue) {
+                options.host = argv[++i];
+            }
+            else if (arg == "--port" && hasValue) {
+                options.port = static_cast<uint16_t>(std::stoi(argv[++i]));
+            }
+            else if (arg == "--connections" && hasValue) {
+                options.connections = static_cast<unsigned>(std::max(1, std::stoi(argv[++i])));
+            }
+            else if (arg == "--duration" && hasValue) {
+                options.durationSec = std::stod(argv[++i]);
+            }
+            else if (arg == "--warmup" && hasValue) {
+                options.warmupSec = std::stod(argv[++i]);
+            }
+            else if (arg == "--rate" && hasValue) {
+                options.rate = std::stod(argv[++i]);
+            }
+            else if (arg == "--weights" && hasValue) {
+                if (!parse_weights(argv[++i], options.weights)) {
+                    return false;
+                }
+            }
+            else if (arg == "--json" && hasValue) {
+                options.jsonFile = argv[++i];
+            }
+            else if (!arg.starts_with("--") && options.mixFile.empty()) {
+                options.mixFile = arg;
+            }
+            else {
+                return false;
+            }
+        }
+        catch (const std::exception&) {   // std::stoi, std::stod.
+            return false;
+        }
+    }
+
+    return !options.mixFile.empty() && options.durationSec > 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--host <ip>] [--port <port>] [--connections <n>] [--duration <sec>] [--warmup <sec>]"
+            " [--rate <requests/sec>] [--keep-alive] [--weights small=60,large=5,listing=15,missing=20] [--json <file>] <mix file>\n";
+        return -1;
+    }
+
+    Mix mix;
+    if (!load_mix(options, mix)) {
+        return -1;
+    }
+
+    sockaddr_in addr;
+    if (!net_startup(options.host, options.port, addr)) {
+        return -1;
+    }
+
+    std::vector<WorkerStats> stats(options.connections);
+    std::vector<std::thread> workers;
+    auto start = Clock::now() + std::chrono::milliseconds{ 50 };   // once every thread is up.
+
+    for (unsigned i = 0; i < options.connections; ++i) {
+        workers.emplace_back(run_worker, std::cref(options), std::cref(mix), std::cref(addr), i, start, std::ref(stats[i]));
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    WorkerStats total;
+    for (auto& s : stats) {
+        total.latency.merge(s.latency);
+        total.service.merge(s.service);
+        total.requests += s.requests;
+        total.errors += s.errors;
+        total.connects += s.connects;
+        total.bytes += s.bytes;
+        for (size_t i = 0; i < CLASS_COUNT; ++i) {
+            total.byClass[i] += s.byClass[i];
+        }
+        for (size_t i = 0; i < total.byStatus.size(); ++i) {
+            total.byStatus[i] += s.byStatus[i];
+        }
+    }
+
+    std::cout << format_text(options, total);
+
+    if (!options.jsonFile.empty()) {
+        auto json = format_json(options, total);
+        if (options.jsonFile == "-") {
+            std::cout << json;
+        }
+        else if (!(std::ofstream{ options.jsonFile } << json)) {
+            std::cerr << "error: cannot write " << options.jsonFile << "\n";
+            return -1;
+        }
+    }
+
+    return total.errors == 0 ? 0 : 1;
+}
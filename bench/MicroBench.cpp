@@ -0,0 +1,414 @@
+/*
+    microbenchmarks of the per-request building blocks of HttpFileServer, the server file is included as is,
+    so they time the code that ships.
+
+    every benchmark is calibrated to run for about --min-time seconds, then timed --repetitions times, the
+    median of the repetitions is shown, and all of them go to the json (--json), so a later run can be compared
+    with a spread, not with a single number.
+
+    build: cl /std:c++20 /EHsc /O2 /I.. MicroBench.cpp ws2_32.lib
+           g++ -std=c++20 -O2 -pthread -I.. MicroBench.cpp -o MicroBench
+    usage: MicroBench [--filter <substring>] [--repetitions <n>] [--min-time <sec>] [--listing-dir <dir>]... [--json <file>]
+
+    --listing-dir adds collecting and rendering a real directory, like one of a tree from tools/TreeGenerator.cpp.
+*/
+#define HFS_NO_MAIN
+#include "HttpFileServer.cpp"
+
+#include <random>
+
+// keeps <value> alive, so the work that produced it isn't optimized away.
+template <class T>
+static void keep(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static const void* volatile sink;
+    sink = &value;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+// the server's connection, over a MemoryTransport.
+using MemoryConnection = BasicHttpConnection<MemoryTransport, StreamFileSource, SharedDirCache, RingAccessLogger>;
+
+/*
+    reaches the private steps of a connection, over a MemoryTransport that only counts the responses, so the
+    kernel isn't part of what is timed.
+*/
+class HttpConnectionBench {
+    std::unique_ptr<MemoryConnection> connection;
+    native_string rootPath;
+public:
+    explicit HttpConnectionBench(const fs::path& root) : rootPath{ root.native() } {
+        connection = std::make_unique<MemoryConnection>(MemoryTransport{ "", false }, sockaddr_storage{}, rootPath);
+        connection->slot = &connectionRegistry.local();
+    }
+
+    void uri_decode(std::string_view uri) {
+        connection->uri = uri;
+        connection->uri_decode();
+        keep(connection->uri);
+    }
+
+    void process_request(std::string_view request) {
+        connection->request = request;
+        connection->process_request();
+        keep(connection->status);
+    }
+};
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations;
+    std::vector<double> samples;   // ns per op, one per repetition.
+
+    double median() const {
+        auto sorted = samples;
+        std::ranges::sort(sorted);
+        auto n = sorted.size();
+        return n % 2 == 1 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    }
+};
+
+struct BenchOptions {
+    std::string filter;
+    unsigned repetitions = 5;
+    double minTimeSec = 0.2;
+    std::vector<fs::path> listingDirs;
+    std::string jsonFile;
+};
+
+class BenchRunner {
+    BenchOptions options;
+    std::vector<BenchResult> results;
+
+    template <class Func>
+    static double time_ns(Func& func, uint64_t iterations) {
+        auto begin = std::chrono::steady_clock::now();
+        func(iterations);
+        auto end = std::chrono::steady_clock::now();
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+    }
+public:
+    explicit BenchRunner(BenchOptions _options) : options{ std::move(_options) } {}
+
+    // <func>(n) does n operations.
+    template <class Func>
+    void run(std::string_view name, Func&& func) {
+        if (name.find(options.filter) == std::string_view::npos) {
+            return;
+        }
+
+        // grow the iterations until a run is long enough to time, then aim at --min-time.
+        uint64_t iterations = 1;
+        double ns;
+        while ((ns = time_ns(func, iterations)) < options.minTimeSec * 1e8 && iterations < (uint64_t{ 1 } << 40)) {
+            iterations *= 2;
+        }
+        iterations = std::max<uint64_t>(1, static_cast<uint64_t>(iterations * (options.minTimeSec * 1e9 / std::max(ns, 1.0))));
+
+        BenchResult result{ std::string{ name }, iterations, {} };
+        for (unsigned i = 0; i < options.repetitions; ++i) {
+            result.samples.push_back(time_ns(func, iterations) / static_cast<double>(iterations));
+        }
+
+        auto [min, max] = std::ranges::minmax(result.samples);
+        std::cout << std::format("{:<40} {:>12} iterations {:>12.1f} ns/op  (min {:.1f}, max {:.1f})\n",
+            name, iterations, result.median(), min, max);
+        results.push_back(std::move(result));
+    }
+
+    bool write_json() const {
+        if (options.jsonFile.empty()) {
+            return true;
+        }
+
+        std::string out = "{\n  \"suite\": \"micro\",\n  \"unit\": \"ns/op\",\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            auto& result = results[i];
+            out += std::format("    {{ \"name\": \"{}\", \"iterations\": {}, \"median\": {:.3f}, \"samples\": [",
+                result.name, result.iterations, result.median());
+            for (size_t j = 0; j < result.samples.size(); ++j) {
+                out += std::format("{}{:.3f}", j == 0 ? "" : ", ", result.samples[j]);
+            }
+            out += std::format("] }}{}\n", i + 1 == results.size() ? "" : ",");
+        }
+        out += "  ]\n}\n";
+
+        if (options.jsonFile == "-") {
+            std::cout << out;
+            return true;
+        }
+        return static_cast<bool>(std::ofstream{ options.jsonFile } << out);
+    }
+};
+
+// a listing like a real directory: mostly plain names, some to escape, some non-ASCII, a few directories.
+static DirListing make_listing(size_t entries) {
+    DirListing listing;
+    std::mt19937_64 rng{ 42 };
+
+    for (size_t i = 0; i < entries; ++i) {
+        std::string name;
+        switch (i % 10) {
+        case 0: name = std::format("dir-{:05}", i); break;
+        case 1: name = std::format("report #{} <draft>.pdf", i); break;
+        case 2: name = std::format("\xe6\x96\x87\xe4\xbb\xb6-{}.txt", i); break;   // 文件-N.txt
+        case 3: name = std::format("javascript:alert({})", i); break;   // ':' must not make a scheme of it.
+        default: name = std::format("asset-{:05}.{}", i, i % 3 == 0 ? "js" : "png"); break;
+        }
+        listing.add(name, i % 10 == 0, rng() % (64 * 1024 * 1024));
+    }
+    return listing;
+}
+
+static void bench_parsing(BenchRunner& runner) {
+    auto root = fs::temp_directory_path();
+    HttpConnectionBench connection{ root };
+
+    runner.run("uri_decode/plain", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            connection.uri_decode("/static/js/vendor/app.bundle.min.js");
+        }
+    });
+
+    runner.run("uri_decode/encoded", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            connection.uri_decode("/%E6%96%87%E4%BB%B6/report%20%231%20%3Cdraft%3E.pdf");
+        }
+    });
+
+    runner.run("process_request/405", [&](uint64_t n) {   // the request line only.
+        for (uint64_t i = 0; i < n; ++i) {
+            connection.process_request("POST /upload HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        }
+    });
+
+    runner.run("process_request/404", [&](uint64_t n) {   // parse, decode, stat, a 404.
+        for (uint64_t i = 0; i < n; ++i) {
+            connection.process_request("GET /no/such%20file.txt HTTP/1.1\r\nHost: localhost\r\nUser-Agent: MicroBench\r\nAccept: */*\r\n\r\n");
+        }
+    });
+}
+
+// <n> whole requests on connections of type <Connection>.
+template <class Connection>
+static void run_connections(uint64_t n, std::string_view request, const sockaddr_storage& client, const native_string& rootPath) {
+    for (uint64_t i = 0; i < n; ++i) {
+        Connection connection{ MemoryTransport{ request, false }, client, rootPath };
+        connection.start();
+    }
+}
+
+/*
+    whole requests like the server runs them, from the construction of the connection to the access record, over
+    a MemoryTransport, in a small tree made for it. the records are discarded, not printed. the same requests also
+    run on other compositions of the policies: mapped files without access log, listings without the cache.
+*/
+static void bench_connection(BenchRunner& runner) {
+    auto root = fs::temp_directory_path() / std::format("hfs-microbench-{}", std::chrono::steady_clock::now().time_since_epoch().count());
+    fs::create_directories(root / "dir");
+    std::ofstream{ root / "page.html", std::ios::binary } << std::string(1024, 'x');
+    for (int i = 0; i < 100; ++i) {
+        std::ofstream{ root / "dir" / std::format("asset-{:03}.js", i), std::ios::binary } << "x";
+    }
+
+    native_string rootPath = root.native();
+    sockaddr_storage client{};
+    client.ss_family = AF_INET;
+
+    constexpr std::string_view NOT_FOUND = "GET /no/such%20file.txt HTTP/1.1\r\nHost: localhost\r\nUser-Agent: MicroBench\r\n\r\n";
+    constexpr std::string_view FILE_1K = "GET /page.html HTTP/1.1\r\nHost: localhost\r\nUser-Agent: MicroBench\r\n\r\n";
+    constexpr std::string_view LISTING = "GET /dir/ HTTP/1.1\r\nHost: localhost\r\nUser-Agent: MicroBench\r\n\r\n";
+    using MappedNoLogConnection = BasicHttpConnection<MemoryTransport, MappedFileSource, SharedDirCache, NullAccessLogger>;
+    using UncachedConnection = BasicHttpConnection<MemoryTransport, StreamFileSource, NoDirCache, RingAccessLogger>;
+
+    accessLogger.discard(true);
+    runner.run("connection/404", [&](uint64_t n) { run_connections<MemoryConnection>(n, NOT_FOUND, client, rootPath); });
+    runner.run("connection/file_1k", [&](uint64_t n) { run_connections<MemoryConnection>(n, FILE_1K, client, rootPath); });
+    runner.run("connection/file_1k/mapped_nolog", [&](uint64_t n) { run_connections<MappedNoLogConnection>(n, FILE_1K, client, rootPath); });
+    runner.run("connection/listing_100", [&](uint64_t n) { run_connections<MemoryConnection>(n, LISTING, client, rootPath); });
+    runner.run("connection/listing_100/nocache", [&](uint64_t n) { run_connections<UncachedConnection>(n, LISTING, client, rootPath); });
+    accessLogger.discard(false);
+
+    std::error_code ec;
+    fs::remove_all(root, ec);
+}
+
+static void bench_mime(BenchRunner& runner) {
+    const std::array<fs::path, 8> paths{ "a/index.html", "a/app.js", "a/style.css", "a/logo.png", "a/video.mp4", "a/data.json", "a/README", "a/photo.jpeg" };
+
+    runner.run("mime_lookup", [&](uint64_t n) {   // like serve_file, misses included.
+        for (uint64_t i = 0; i < n; ++i) {
+            auto extension = paths[i % paths.size()].extension().string();
+            auto iter = HTTP_MIME_TABLE.find(extension);
+            keep(iter);
+        }
+    });
+}
+
+static void bench_file_size(BenchRunner& runner) {
+    const std::array<uintmax_t, 4> sizes{ 512, 15 * 1024 + 300, 734 * 1024 * 1024, uintmax_t{ 3 } << 40 };
+    OutputBuffer out;
+
+    runner.run("build_file_size", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            out.clear();
+            build_file_size(out, sizes[i % sizes.size()]);
+            keep(out);
+        }
+    });
+}
+
+static void bench_listing(BenchRunner& runner, const std::vector<fs::path>& dirs) {
+    for (auto& dir : dirs) {
+        auto name = dir.filename().empty() ? dir.parent_path().filename() : dir.filename();
+        OutputBuffer out;
+
+        runner.run(std::format("serve_dir_collect/{}", name.string()), [&](uint64_t n) {   // the cache miss path.
+            for (uint64_t i = 0; i < n; ++i) {
+                DirListing listing;
+                listing.collect(dir);
+                keep(listing);
+            }
+        });
+
+        DirListing listing;
+        listing.collect(dir);
+        runner.run(std::format("serve_dir_render/{}", name.string()), [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                out.clear();
+                listing.render(out, "/dir/");
+                keep(out);
+            }
+        });
+    }
+
+    for (size_t entries : { 100, 10000 }) {
+        auto listing = make_listing(entries);
+        OutputBuffer out;
+
+        runner.run(std::format("serve_dir_render/{}", entries), [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                out.clear();
+                listing.render(out, "/media/\xe6\x96\x87\xe4\xbb\xb6/");
+                keep(out);
+            }
+        });
+    }
+}
+
+#ifdef _WIN32
+static void bench_conv(BenchRunner& runner) {
+    const std::string ascii = "C:\\Users\\Public\\Documents\\report-2024-final.txt";
+    const std::string utf8 = "/\xe6\x96\x87\xe4\xbb\xb6/\xe3\x83\x86\xe3\x82\xb9\xe3\x83\x88-report.txt";
+    const std::wstring wide = conv_utf8_to_unicode(utf8);
+    const std::wstring wideAscii = conv_ascii_to_unicode(ascii);
+    std::string narrowScratch;
+    std::wstring wideScratch;
+
+    runner.run("conv_ascii_to_unicode", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            keep(conv_ascii_to_unicode(ascii, wideScratch));
+        }
+    });
+
+    runner.run("conv_unicode_to_ascii", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            keep(conv_unicode_to_ascii(wideAscii, narrowScratch));
+        }
+    });
+
+    runner.run("conv_utf8_to_unicode", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            keep(conv_utf8_to_unicode(utf8, wideScratch));
+        }
+    });
+
+    runner.run("conv_unicode_to_utf8", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            keep(conv_unicode_to_utf8(wide, narrowScratch));
+        }
+    });
+
+    runner.run("conv_utf8_to_ascii", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            keep(conv_utf8_to_ascii(utf8, narrowScratch));
+        }
+    });
+}
+#endif
+
+static void bench_thread_pool(BenchRunner& runner) {
+    for (size_t workers : { 1, 4 }) {
+        ThreadPool pool{ workers };
+        std::atomic<uint64_t> done{ 0 };
+
+        runner.run(std::format("thread_pool_dispatch/{}", workers), [&](uint64_t n) {   // add_task to the end of the task.
+            done.store(0, std::memory_order_relaxed);
+            for (uint64_t i = 0; i < n; ++i) {
+                pool.add_task([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+            }
+            while (done.load(std::memory_order_relaxed) != n) {
+                std::this_thread::yield();
+            }
+        });
+    }
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--filter" && hasValue) {
+            options.filter = argv[++i];
+        }
+        else if (arg == "--repetitions" && hasValue) {
+            options.repetitions = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        }
+        else if (arg == "--min-time" && hasValue) {
+            options.minTimeSec = std::max(0.001, std::atof(argv[++i]));
+        }
+        else if (arg == "--listing-dir" && hasValue) {
+            options.listingDirs.emplace_back(argv[++i]);
+        }
+        else if (arg == "--json" && hasValue) {
+            options.jsonFile = argv[++i];
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--filter <substring>] [--repetitions <n>] [--min-time <sec>] [--listing-dir <dir>]... [--json <file>]\n";
+            return -1;
+        }
+    }
+
+#ifndef _WIN32
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+    BenchRunner runner{ options };
+    try {
+        bench_parsing(runner);
+        bench_connection(runner);
+        bench_mime(runner);
+        bench_file_size(runner);
+        bench_listing(runner, options.listingDirs);
+#ifdef _WIN32
+        bench_conv(runner);
+#endif
+        bench_thread_pool(runner);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+
+    if (!runner.write_json()) {
+        std::cerr << "error: cannot write " << options.jsonFile << "\n";
+        return -1;
+    }
+    return 0;
+}
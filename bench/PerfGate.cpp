@@ -0,0 +1,512 @@
+/*
+    performance regression gate: compares runs of a benchmark against a baseline of earlier runs of it.
+
+    takes the --json results of LoadGenerator, AccessLogReplay, SoakTest and MicroBench. a baseline is a file of
+    runs (bench/baselines/), written by "record". "compare" puts every gated metric of the new runs against it:
+        throughput_rps                  higher is better, fails past --threshold percent (5).
+        latency_us.p99, service_us.p99  lower is better, fails past --tail-threshold percent (15), tails are noisier.
+        <benchmark>.median              ns/op of MicroBench, lower is better, fails past --threshold.
+    runs of the same build differ, so a metric fails only when all of the 95% confidence interval of the difference
+    of the means (Welch) is worse than its threshold, one only worse on average is shown as noise. with a single run
+    on either side there is no interval and the threshold alone decides, so take 3 or more runs on each side.
+    exits 1 on a regression, a metric of the baseline the runs don't have is one too.
+
+    the numbers are of one machine, record the baseline on the machine that compares, from the commit the change
+    starts from, before changing HttpConnection or ThreadPool, like:
+        for i in 1 2 3 4 5; do LoadGenerator --port 8080 --connections 8 --duration 5 mix.txt --json base$i.json; done
+        PerfGate record --note "LoadGenerator --connections 8 --duration 5, tg_media" bench/baselines/loadgen.json base*.json
+    then with the change built, the same runs to new*.json and:
+        PerfGate compare bench/baselines/loadgen.json new*.json
+    a machine drifts over minutes (turbo, other load), alternating the runs of the two builds cancels most of it.
+    the baselines committed in bench/baselines/ say how they were taken in their "note", as a starting point.
+
+    build: cl /std:c++20 /EHsc /O2 PerfGate.cpp
+           g++ -std=c++20 -O2 PerfGate.cpp -o PerfGate
+    usage: PerfGate record [--note <text>] <baseline> <run.json>...
+           PerfGate compare [--threshold <percent>] [--tail-threshold <percent>] <baseline> <run.json>...
+*/
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <array>
+#include <format>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+
+/*
+    just enough JSON for the results of the benchmarks.
+*/
+struct Json {
+    enum Kind : uint8_t {
+        JSON_NULL,
+        JSON_BOOL,
+        JSON_NUMBER,
+        JSON_STRING,
+        JSON_ARRAY,
+        JSON_OBJECT
+    };
+
+    Kind kind = JSON_NULL;
+    double number = 0;
+    std::string string;
+    std::vector<Json> items;   // of an array, or the values of an object.
+    std::vector<std::string> keys;   // of an object.
+
+    const Json* find(std::string_view key) const {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (keys[i] == key) {
+                return &items[i];
+            }
+        }
+        return nullptr;
+    }
+};
+
+class JsonParser {
+    static constexpr unsigned MAX_DEPTH = 64;
+
+    std::string_view text;
+    size_t pos = 0;
+public:
+    explicit JsonParser(std::string_view json) :
+        text{ json }
+    {}
+
+    bool parse(Json& value) {
+        if (!parse_value(value, 0)) {
+            return false;
+        }
+        skip_space();
+        return pos == text.size();
+    }
+private:
+    void skip_space() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n')) {
+            ++pos;
+        }
+    }
+
+    bool consume(char c) {
+        skip_space();
+        if (pos < text.size() && text[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    bool consume_word(std::string_view word) {
+        if (text.substr(pos).starts_with(word)) {
+            pos += word.size();
+            return true;
+        }
+        return false;
+    }
+
+    bool parse_string(std::string& out) {
+        if (!consume('"')) {
+            return false;
+        }
+
+        out.clear();
+        while (pos < text.size()) {
+            char c = text[pos++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos >= text.size()) {
+                return false;
+            }
+
+            switch (char escaped = text[pos++]) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {   // as UTF-8, the names of the benchmarks are ASCII, so surrogate pairs aren't joined.
+                uint32_t code;
+                if (pos + 4 > text.size() || std::from_chars(text.data() + pos, text.data() + pos + 4, code, 16).ec != std::errc{}) {
+                    return false;
+                }
+                pos += 4;
+                if (code < 0x80) {
+                    out += static_cast<char>(code);
+                }
+                else if (code < 0x800) {
+                    out += static_cast<char>(0xc0 | (code >> 6));
+                    out += static_cast<char>(0x80 | (code & 0x3f));
+                }
+                else {
+                    out += static_cast<char>(0xe0 | (code >> 12));
+                    out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+                    out += static_cast<char>(0x80 | (code & 0x3f));
+                }
+                break;
+            }
+            default: out += escaped; break;   // '"', '\\' and '/'.
+            }
+        }
+        return false;
+    }
+
+    bool parse_value(Json& value, unsigned depth) {
+        skip_space();
+        if (pos >= text.size() || depth > MAX_DEPTH) {
+            return false;
+        }
+
+        char c = text[pos];
+        if (c == '"') {
+            value.kind = Json::JSON_STRING;
+            return parse_string(value.string);
+        }
+        if (c == '{' || c == '[') {
+            bool isObject = c == '{';
+            char close = isObject ? '}' : ']';
+            value.kind = isObject ? Json::JSON_OBJECT : Json::JSON_ARRAY;
+            ++pos;
+
+            if (consume(close)) {
+                return true;
+            }
+            do {
+                if (isObject) {
+                    value.keys.emplace_back();
+                    if (!parse_string(value.keys.back()) || !consume(':')) {
+                        return false;
+                    }
+                }
+                value.items.emplace_back();
+                if (!parse_value(value.items.back(), depth + 1)) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(close);
+        }
+        if (consume_word("true")) {
+            value.kind = Json::JSON_BOOL;
+            value.number = 1;
+            return true;
+        }
+        if (consume_word("false")) {
+            value.kind = Json::JSON_BOOL;
+            return true;
+        }
+        if (consume_word("null")) {
+            return true;
+        }
+
+        auto [end, ec] = std::from_chars(text.data() + pos, text.data() + text.size(), value.number);
+        if (ec != std::errc{}) {
+            return false;
+        }
+        value.kind = Json::JSON_NUMBER;
+        pos = static_cast<size_t>(end - text.data());
+        return true;
+    }
+};
+
+static bool read_json(const std::string& file, std::string& text, Json& json) {
+    std::ifstream in{ file, std::ios::binary };
+    if (!in) {
+        std::cerr << "error: cannot open " << file << "\n";
+        return false;
+    }
+
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    text = buffer.str();
+    if (!JsonParser{ text }.parse(json)) {
+        std::cerr << "error: " << file << " is not valid JSON.\n";
+        return false;
+    }
+    return true;
+}
+
+// the numbers of a run by their path, like "latency_us.p99", an array item with a "name" goes by it.
+static void flatten(const Json& value, const std::string& prefix, std::map<std::string, double>& out) {
+    auto join = [&](std::string_view key) { return prefix.empty() ? std::string{ key } : std::format("{}.{}", prefix, key); };
+
+    if (value.kind == Json::JSON_NUMBER) {
+        out[prefix] = value.number;
+    }
+    else if (value.kind == Json::JSON_ARRAY) {
+        for (size_t i = 0; i < value.items.size(); ++i) {
+            auto name = value.items[i].find("name");
+            flatten(value.items[i], join(name != nullptr && name->kind == Json::JSON_STRING ? name->string : std::to_string(i)), out);
+        }
+    }
+    else if (value.kind == Json::JSON_OBJECT) {
+        for (size_t i = 0; i < value.keys.size(); ++i) {
+            flatten(value.items[i], join(value.keys[i]), out);
+        }
+    }
+}
+
+// "mode" of the load tools, "suite" of MicroBench, runs of different benchmarks don't compare.
+static std::string kind_of(const Json& run) {
+    for (auto key : { "mode", "suite" }) {
+        auto value = run.find(key);
+        if (value != nullptr && value->kind == Json::JSON_STRING) {
+            return value->string;
+        }
+    }
+    return {};
+}
+
+enum Direction : uint8_t {
+    NOT_GATED,
+    HIGHER_IS_BETTER,
+    LOWER_IS_BETTER
+};
+
+struct Thresholds {
+    double percent = 5;
+    double tailPercent = 15;
+};
+
+static Direction direction_of(std::string_view metric, const Thresholds& thresholds, double& percent) {
+    if (metric == "throughput_rps" || metric.ends_with(".median")) {
+        percent = thresholds.percent;
+        return metric == "throughput_rps" ? HIGHER_IS_BETTER : LOWER_IS_BETTER;
+    }
+    if (metric == "latency_us.p99" || metric == "service_us.p99") {
+        percent = thresholds.tailPercent;
+        return LOWER_IS_BETTER;
+    }
+    return NOT_GATED;
+}
+
+// the 0.975 quantile of Student's t, for a two sided 95% interval.
+static double t_975(double degrees) {
+    constexpr std::array<double, 30> TABLE{ 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+    auto df = static_cast<size_t>(std::max(1.0, std::floor(degrees)));
+    return df <= TABLE.size() ? TABLE[df - 1] : 1.96 + 2.5 / static_cast<double>(df);   // within 0.002 past 30.
+}
+
+struct Sample {
+    size_t n = 0;
+    double mean = 0;
+    double variance = 0;   // of the sample, 0 for a single value.
+
+    static Sample of(const std::vector<double>& values) {
+        Sample sample;
+        sample.n = values.size();
+        for (auto value : values) {
+            sample.mean += value / static_cast<double>(sample.n);
+        }
+        for (auto value : values) {
+            sample.variance += (value - sample.mean) * (value - sample.mean) / static_cast<double>(std::max<size_t>(sample.n - 1, 1));
+        }
+        return sample;
+    }
+
+    // the half width of the 95% confidence interval of the mean.
+    double interval() const {
+        return n < 2 ? 0 : t_975(static_cast<double>(n - 1)) * std::sqrt(variance / static_cast<double>(n));
+    }
+};
+
+static int record(const std::string& note, const std::string& baselineFile, const std::vector<std::string>& runFiles) {
+    std::string out = "{\n";
+    if (!note.empty()) {
+        out += "  \"note\": \"";
+        for (char c : note) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+            }
+            out += c;
+        }
+        out += "\",\n";
+    }
+    out += "  \"runs\": [\n";
+
+    std::string kind;
+    for (size_t i = 0; i < runFiles.size(); ++i) {
+        std::string text;
+        Json run;
+        if (!read_json(runFiles[i], text, run)) {
+            return -1;
+        }
+        if (i == 0) {
+            kind = kind_of(run);
+        }
+        else if (kind_of(run) != kind) {
+            std::cerr << "error: " << runFiles[i] << " is a run of another benchmark.\n";
+            return -1;
+        }
+
+        while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) {
+            text.pop_back();
+        }
+        out += text;
+        out += i + 1 < runFiles.size() ? ",\n" : "\n";
+    }
+    out += "  ]\n}\n";
+
+    if (!(std::ofstream{ baselineFile, std::ios::binary } << out)) {
+        std::cerr << "error: cannot write " << baselineFile << "\n";
+        return -1;
+    }
+    std::cout << std::format("{}: {} runs of {}\n", baselineFile, runFiles.size(), kind.empty() ? "?" : kind);
+    return 0;
+}
+
+static int compare(const Thresholds& thresholds, const std::string& baselineFile, const std::vector<std::string>& runFiles) {
+    std::string text;
+    Json baseline;
+    if (!read_json(baselineFile, text, baseline)) {
+        return -1;
+    }
+    auto baseRuns = baseline.find("runs");
+    if (baseRuns == nullptr || baseRuns->kind != Json::JSON_ARRAY || baseRuns->items.empty()) {
+        std::cerr << "error: " << baselineFile << " has no runs, write it with \"record\".\n";
+        return -1;
+    }
+
+    auto kind = kind_of(baseRuns->items.front());
+    std::map<std::string, std::vector<double>> before;
+    std::map<std::string, std::vector<double>> after;
+    for (auto& run : baseRuns->items) {
+        std::map<std::string, double> values;
+        flatten(run, {}, values);
+        for (auto& [metric, value] : values) {
+            before[metric].push_back(value);
+        }
+    }
+    for (auto& file : runFiles) {
+        Json run;
+        if (!read_json(file, text, run)) {
+            return -1;
+        }
+        if (kind_of(run) != kind) {
+            std::cerr << "error: " << file << " is not a run of the benchmark of the baseline.\n";
+            return -1;
+        }
+
+        std::map<std::string, double> values;
+        flatten(run, {}, values);
+        for (auto& [metric, value] : values) {
+            after[metric].push_back(value);
+        }
+    }
+
+    std::string out = std::format("{} runs of the baseline, {} new ones.\n", baseRuns->items.size(), runFiles.size());
+    if (baseRuns->items.size() < 2 || runFiles.size() < 2) {
+        out += "warning: a single run on one side has no confidence interval, only the thresholds apply.\n";
+    }
+    out += std::format("{:<40} {:>22} {:>22} {:>8} {:>6}  {}\n", "metric", "baseline", "new", "change", "limit", "verdict");
+
+    uint64_t regressions = 0;
+    for (auto& [metric, values] : before) {
+        double percent;
+        auto direction = direction_of(metric, thresholds, percent);
+        if (direction == NOT_GATED) {
+            continue;
+        }
+
+        auto base = Sample::of(values);
+        auto found = after.find(metric);
+        if (found == after.end()) {
+            out += std::format("{:<40} {:>22} {:>22} {:>8} {:>6}  MISSING\n", metric, std::format("{:.1f}", base.mean), "-", "-", "-");
+            ++regressions;
+            continue;
+        }
+
+        auto now = Sample::of(found->second);
+        // how much worse, so positive is a regression whatever the direction.
+        auto worse = direction == HIGHER_IS_BETTER ? base.mean - now.mean : now.mean - base.mean;
+        auto changePercent = base.mean == 0 ? 0 : 100 * worse / std::abs(base.mean);
+
+        // Welch: the interval of the difference without assuming the variances are equal.
+        auto baseVar = base.variance / static_cast<double>(base.n);
+        auto nowVar = now.variance / static_cast<double>(now.n);
+        double margin = 0;
+        if (base.n >= 2 && now.n >= 2 && baseVar + nowVar > 0) {
+            auto degrees = (baseVar + nowVar) * (baseVar + nowVar)
+                / (baseVar * baseVar / static_cast<double>(base.n - 1) + nowVar * nowVar / static_cast<double>(now.n - 1));
+            margin = t_975(degrees) * std::sqrt(baseVar + nowVar);
+        }
+
+        auto limit = std::abs(base.mean) * percent / 100;
+        std::string_view verdict = "ok";
+        if (worse - margin > limit) {
+            verdict = "REGRESSED";
+            ++regressions;
+        }
+        else if (changePercent > percent) {
+            verdict = "noise";   // past the threshold, but within what the runs vary by.
+        }
+        else if (-worse - margin > limit) {
+            verdict = "improved";
+        }
+
+        auto shown = [](const Sample& sample) {
+            return sample.n < 2 ? std::format("{:.1f}", sample.mean)
+                : std::format("{:.1f} ±{:.1f}%", sample.mean, sample.mean == 0 ? 0 : 100 * sample.interval() / std::abs(sample.mean));
+        };
+        out += std::format("{:<40} {:>22} {:>22} {:>7.1f}% {:>5.0f}%  {}\n",
+            metric, shown(base), shown(now), direction == HIGHER_IS_BETTER ? -changePercent : changePercent, percent, verdict);
+    }
+
+    out += regressions == 0 ? "no regression.\n" : std::format("{} regressions.\n", regressions);
+    std::cout << out;
+    return regressions == 0 ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    std::string_view command = argc > 1 ? argv[1] : "";
+    std::string note;
+    Thresholds thresholds;
+    std::vector<std::string> files;
+
+    bool ok = command == "record" || command == "compare";
+    for (int i = 2; ok && i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        try {
+            if (arg == "--note" && hasValue && command == "record") {
+                note = argv[++i];
+            }
+            else if (arg == "--threshold" && hasValue && command == "compare") {
+                thresholds.percent = std::stod(argv[++i]);
+            }
+            else if (arg == "--tail-threshold" && hasValue && command == "compare") {
+                thresholds.tailPercent = std::stod(argv[++i]);
+            }
+            else if (!arg.starts_with("--")) {
+                files.emplace_back(arg);
+            }
+            else {
+                ok = false;
+            }
+        }
+        catch (const std::exception&) {   // std::stod.
+            ok = false;
+        }
+    }
+
+    if (!ok || files.size() < 2) {
+        std::cerr << "Usage: " << argv[0] << " record [--note <text>] <baseline> <run.json>...\n"
+            << "       " << argv[0] << " compare [--threshold <percent>] [--tail-threshold <percent>] <baseline> <run.json>...\n";
+        return -1;
+    }
+
+    std::vector<std::string> runFiles(files.begin() + 1, files.end());
+    return command == "record" ? record(note, files.front(), runFiles) : compare(thresholds, files.front(), runFiles);
+}
@@ -0,0 +1,625 @@
+/*
+    soak test of HttpFileServer under many slow clients, C10K and past it.
+
+    a worker of the server is held by any connection it has accepted until the request arrives, up to
+    HTTP_RECV_TIMEOUT_SEC, and then until the response is in the socket buffer. so while well behaved clients
+    (the probe) send requests at --probe-rate, this keeps open:
+    --idle <n>     connections that never send anything.
+    --trickle <n>  slowloris, a request header sent a byte every --trickle-ms, that never ends.
+    --readers <n>  connections that ask for --reader-path and read --reader-bytes of it every --reader-ms, with a
+                   small receive buffer.
+    a slow connection the server closes is opened again, so the pressure stays, new ones open at --ramp per second.
+    every second a line shows the slow connections, the latency of the probe (counted from when each probe was due,
+    like the open loop of LoadGenerator), and with --pid the memory, threads and handles of the server.
+
+    the slow connections are non-blocking sockets polled by one thread, so tens of thousands take little. on Linux
+    the limit of open files is raised to its hard limit, and a client address has ~28K ports to the same server:
+    past that, widen net.ipv4.ip_local_port_range or bind to more loopback addresses with --source 127.0.0.2 ...
+
+    build: cl /std:c++20 /EHsc /O2 SoakTest.cpp ws2_32.lib
+           g++ -std=c++20 -O2 -pthread SoakTest.cpp -o SoakTest
+    usage: SoakTest [--host <ip>] [--port <port>] [--idle <n>] [--trickle <n>] [--readers <n>] [--duration <sec>]
+                    [--ramp <n>] [--trickle-ms <ms>] [--reader-path <path>] [--reader-bytes <n>] [--reader-ms <ms>]
+                    [--probe-rate <n>] [--probe-path <path>] [--pid <server pid>] [--source <ip>]... [--json <file>]
+*/
+#include "HttpLoad.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#include <tlhelp32.h>
+#else
+#include <poll.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <sys/resource.h>
+#endif
+
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <format>
+#include <filesystem>
+#include <algorithm>
+#include <cstdint>
+
+namespace fs = std::filesystem;
+
+constexpr uint32_t TICK_MS = 50;   // how often the slow connections are polled and served.
+constexpr int READER_RCVBUF_LEN = 4096;
+
+#ifdef _WIN32
+using PollFd = WSAPOLLFD;
+
+static int poll_sockets(std::vector<PollFd>& fds) {
+    return WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), 0);
+}
+
+static bool would_block() {
+    auto error = WSAGetLastError();
+    return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS;
+}
+
+static bool set_non_blocking(SOCKET sock) {
+    u_long nonBlocking = 1;
+    return ioctlsocket(sock, FIONBIO, &nonBlocking) == 0;
+}
+#else
+using PollFd = pollfd;
+
+static int poll_sockets(std::vector<PollFd>& fds) {
+    return poll(fds.data(), fds.size(), 0);
+}
+
+static bool would_block() {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+}
+
+static bool set_non_blocking(SOCKET sock) {
+    return fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) == 0;
+}
+#endif
+
+enum SlowKind : uint8_t {
+    SLOW_IDLE,
+    SLOW_TRICKLE,
+    SLOW_READER,
+    SLOW_KINDS
+};
+
+constexpr std::array<std::string_view, SLOW_KINDS> SLOW_KIND_NAMES{ "idle", "trickle", "reader" };
+
+struct Options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 8080;
+    std::array<uint32_t, SLOW_KINDS> slow{};
+    uint32_t durationSec = 60;
+    uint32_t ramp = 2000;
+    uint32_t trickleMs = 1000;
+    std::string readerPath = "/";
+    uint32_t readerBytes = 1024;
+    uint32_t readerMs = 1000;
+    double probeRate = 10;
+    std::string probePath = "/";
+    uint32_t pid = 0;
+    std::vector<std::string> sources;
+    std::string jsonFile;
+};
+
+/*
+    memory, threads and handles (file descriptors) of the server, from /proc on Linux.
+*/
+struct ProcessSample {
+    bool valid = false;
+    uint64_t rssBytes = 0;
+    uint64_t threads = 0;
+    uint64_t handles = 0;
+
+    static ProcessSample of(uint32_t pid) {
+        ProcessSample sample;
+        if (pid == 0) {
+            return sample;
+        }
+
+#ifdef _WIN32
+        auto process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ, FALSE, pid);
+        if (process == nullptr) {
+            return sample;
+        }
+
+        PROCESS_MEMORY_COUNTERS memory;
+        DWORD handles;
+        if (K32GetProcessMemoryInfo(process, &memory, sizeof(memory)) && GetProcessHandleCount(process, &handles)) {
+            sample.rssBytes = memory.WorkingSetSize;
+            sample.handles = handles;
+            sample.valid = true;
+        }
+        CloseHandle(process);
+
+        auto snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+        if (snapshot != INVALID_HANDLE_VALUE) {
+            THREADENTRY32 thread{ sizeof(THREADENTRY32) };
+            for (auto more = Thread32First(snapshot, &thread); more; more = Thread32Next(snapshot, &thread)) {
+                sample.threads += thread.th32OwnerProcessID == pid;
+            }
+            CloseHandle(snapshot);
+        }
+#else
+        std::ifstream status{ std::format("/proc/{}/status", pid) };
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.starts_with("VmRSS:")) {
+                sample.rssBytes = std::stoull(line.substr(6)) * 1024;
+                sample.valid = true;
+            }
+            else if (line.starts_with("Threads:")) {
+                sample.threads = std::stoull(line.substr(8));
+            }
+        }
+
+        std::error_code ec;
+        for (fs::directory_iterator it{ std::format("/proc/{}/fd", pid), ec }, end; !ec && it != end; it.increment(ec)) {
+            ++sample.handles;
+        }
+#endif
+        return sample;
+    }
+};
+
+/*
+    the slow connections. slot i is of one kind for the whole run, a slot closed by either side is opened again.
+*/
+class SlowClients {
+    struct Slot {
+        SOCKET sock = INVALID_SOCKET;
+        SlowKind kind = SLOW_IDLE;
+        bool connected = false;
+        Clock::time_point opened;
+        Clock::time_point nextAction;
+        uint64_t sent = 0;
+    };
+
+    const Options& options;
+    const sockaddr_in& addr;
+    std::vector<sockaddr_in> sources;
+    std::vector<Slot> slots;
+    std::vector<PollFd> fds;   // fds[i] is slots[i].sock.
+    std::vector<size_t> closed;
+    std::string trickleHeader;
+    std::string readerRequest;
+    std::vector<char> buffer = std::vector<char>(RECV_BUFFER_LEN);
+    double rampBudget = 0;
+public:
+    std::array<Histogram, SLOW_KINDS> lifetimes;   // of the connections the server closed.
+    std::array<uint64_t, SLOW_KINDS> serverCloses{};
+    std::array<uint64_t, SLOW_KINDS> answered{};   // responses to a trickle, read to the end by a reader.
+    uint64_t opened = 0;
+    uint64_t connectFailures = 0;
+    uint64_t open = 0;
+    uint64_t openPeak = 0;
+
+    SlowClients(const Options& opts, const sockaddr_in& serverAddr) :
+        options{ opts }, addr{ serverAddr }
+    {
+        for (auto& source : options.sources) {
+            sockaddr_in sourceAddr{};
+            sourceAddr.sin_family = AF_INET;
+            if (inet_pton(AF_INET, source.c_str(), &sourceAddr.sin_addr) == 1) {
+                sources.push_back(sourceAddr);
+            }
+            else {
+                std::cerr << "error: " << source << " is not an IPv4 address, ignored.\n";
+            }
+        }
+
+        for (uint8_t kind = 0; kind < SLOW_KINDS; ++kind) {
+            for (uint32_t i = 0; i < options.slow[kind]; ++i) {
+                Slot slot;
+                slot.kind = static_cast<SlowKind>(kind);
+                slots.push_back(slot);
+            }
+        }
+        fds.resize(slots.size());
+        for (auto& fd : fds) {
+            fd.fd = INVALID_SOCKET;
+        }
+        for (size_t i = slots.size(); i-- > 0;) {
+            closed.push_back(i);
+        }
+
+        trickleHeader = std::format("GET {} HTTP/1.1\r\nHost: {}\r\nUser-Agent: SoakTest\r\n", percent_encode(options.probePath), options.host);
+        readerRequest = std::format("GET {} HTTP/1.1\r\nHost: {}\r\n\r\n", percent_encode(options.readerPath), options.host);
+    }
+
+    SlowClients(const SlowClients&) = delete;
+
+    ~SlowClients() {
+        for (auto& slot : slots) {
+            if (slot.sock != INVALID_SOCKET) {
+                closesocket(slot.sock);
+            }
+        }
+    }
+
+    // one round: opens what the ramp allows, then reads and writes what is due.
+    void tick(Clock::time_point now) {
+        rampBudget = std::min(rampBudget + options.ramp * TICK_MS / 1000.0, static_cast<double>(options.ramp));
+        while (rampBudget >= 1 && !closed.empty()) {
+            auto i = closed.back();
+            closed.pop_back();
+            rampBudget -= 1;
+            open_slot(i, now);
+        }
+
+        if (poll_sockets(fds) > 0) {
+            for (size_t i = 0; i < slots.size(); ++i) {
+                if (fds[i].revents != 0 && slots[i].sock != INVALID_SOCKET) {
+                    on_ready(i, fds[i].revents, now);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].connected && now >= slots[i].nextAction) {
+                act(i, now);
+            }
+        }
+    }
+private:
+    void open_slot(size_t i, Clock::time_point now) {
+        auto& slot = slots[i];
+        slot.sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (slot.sock == INVALID_SOCKET) {
+            ++connectFailures;
+            closed.insert(closed.begin(), i);   // tried again after the others, out of handles most likely.
+            return;
+        }
+
+        if (slot.kind == SLOW_READER) {   // before connect(), it sets the window the server sees.
+            setsockopt(slot.sock, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&READER_RCVBUF_LEN), sizeof(READER_RCVBUF_LEN));
+        }
+        if (!sources.empty()) {
+            auto& source = sources[i % sources.size()];
+            bind(slot.sock, reinterpret_cast<const sockaddr*>(&source), sizeof(source));
+        }
+
+        set_non_blocking(slot.sock);
+        if (connect(slot.sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 && !would_block()) {
+            ++connectFailures;
+            close_slot(i);
+            return;
+        }
+
+        slot.connected = false;
+        slot.opened = now;
+        slot.sent = 0;
+        fds[i].fd = slot.sock;
+        fds[i].events = POLLOUT;
+        fds[i].revents = 0;
+        ++opened;
+        openPeak = std::max(openPeak, ++open);
+    }
+
+    void close_slot(size_t i) {
+        auto& slot = slots[i];
+        if (fds[i].fd != INVALID_SOCKET) {
+            --open;
+        }
+        closesocket(slot.sock);
+        slot.sock = INVALID_SOCKET;
+        slot.connected = false;
+        fds[i].fd = INVALID_SOCKET;
+        fds[i].events = 0;
+        closed.push_back(i);
+    }
+
+    void closed_by_server(size_t i, Clock::time_point now) {
+        auto kind = slots[i].kind;
+        ++serverCloses[kind];
+        lifetimes[kind].record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - slots[i].opened).count());
+        close_slot(i);
+    }
+
+    void on_ready(size_t i, short revents, Clock::time_point now) {
+        auto& slot = slots[i];
+
+        if (!slot.connected) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(slot.sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &len);
+            if (error != 0 || (revents & (POLLERR | POLLHUP)) != 0) {
+                ++connectFailures;
+                close_slot(i);
+                return;
+            }
+
+            slot.connected = true;
+            fds[i].events = POLLIN;
+            // spread the first action over the interval, so the slots don't all act in the same tick.
+            auto interval = slot.kind == SLOW_TRICKLE ? options.trickleMs : options.readerMs;
+            slot.nextAction = now + std::chrono::milliseconds{ i % std::max<uint32_t>(interval, 1) };
+            if (slot.kind == SLOW_READER && send(slot.sock, readerRequest.data(), static_cast<int>(readerRequest.size()), 0) <= 0) {
+                closed_by_server(i, now);
+            }
+            return;
+        }
+
+        if (slot.kind == SLOW_READER) {   // reads at its own pace, a close shows when it gets there.
+            return;
+        }
+
+        auto len = recv(slot.sock, buffer.data(), static_cast<int>(buffer.size()), 0);
+        if (len > 0) {
+            ++answered[slot.kind];
+        }
+        else if (len == 0 || !would_block()) {
+            closed_by_server(i, now);
+        }
+    }
+
+    void act(size_t i, Clock::time_point now) {
+        auto& slot = slots[i];
+
+        if (slot.kind == SLOW_TRICKLE) {
+            constexpr std::string_view MORE = "X-Trickle: 1\r\n";   // the header never ends.
+            char c = slot.sent < trickleHeader.size() ? trickleHeader[slot.sent] : MORE[(slot.sent - trickleHeader.size()) % MORE.size()];
+            if (send(slot.sock, &c, 1, 0) == 1) {
+                ++slot.sent;
+            }
+            else if (!would_block()) {
+                closed_by_server(i, now);
+                return;
+            }
+            slot.nextAction += std::chrono::milliseconds{ options.trickleMs };
+        }
+        else if (slot.kind == SLOW_READER) {
+            auto len = recv(slot.sock, buffer.data(), static_cast<int>(std::min<size_t>(options.readerBytes, buffer.size())), 0);
+            if (len == 0) {
+                ++answered[SLOW_READER];
+                close_slot(i);
+                return;
+            }
+            if (len < 0 && !would_block()) {
+                closed_by_server(i, now);
+                return;
+            }
+            slot.nextAction += std::chrono::milliseconds{ options.readerMs };
+        }
+        else {
+            slot.nextAction = Clock::time_point::max();
+        }
+    }
+};
+
+/*
+    the well behaved client: a request at a time, each due at a fixed rate, on a new connection.
+*/
+class Probe {
+    std::mutex mut;
+    Histogram interval;
+    uint64_t intervalErrors = 0;
+public:
+    Histogram total;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+
+    void run(const Options& options, const sockaddr_in& addr, Clock::time_point start, const std::atomic<bool>& stop) {
+        auto message = std::format("GET {} HTTP/1.1\r\nHost: {}\r\n\r\n", percent_encode(options.probePath), options.host);
+        HttpClient client;
+
+        for (uint64_t k = 0; !stop.load(std::memory_order_relaxed); ++k) {
+            auto due = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(k / options.probeRate));
+            std::this_thread::sleep_until(due);
+
+            uint16_t status = 0;
+            uint64_t bytes = 0;
+            bool mustClose = true;
+            bool ok = client.open(addr) && client.send_all(message) && client.read_response(status, bytes, mustClose) && status < 500;
+            auto latencyNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - due).count();
+            client.close();
+
+            std::lock_guard lock{ mut };
+            if (ok) {
+                interval.record(latencyNs);
+                total.record(latencyNs);
+                ++requests;
+            }
+            else {
+                ++intervalErrors;
+                ++errors;
+            }
+        }
+    }
+
+    // the latency and errors since the last call.
+    std::pair<Histogram, uint64_t> take_interval() {
+        std::lock_guard lock{ mut };
+        std::pair<Histogram, uint64_t> taken{ std::move(interval), intervalErrors };
+        interval = Histogram{};
+        intervalErrors = 0;
+        return taken;
+    }
+};
+
+static bool parse_options(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        try {
+            if (arg == "--host") {
+                options.host = argv[++i];
+            }
+            else if (arg == "--port") {
+                options.port = static_cast<uint16_t>(std::stoi(argv[++i]));
+            }
+            else if (arg == "--idle") {
+                options.slow[SLOW_IDLE] = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--trickle") {
+                options.slow[SLOW_TRICKLE] = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--readers") {
+                options.slow[SLOW_READER] = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--duration") {
+                options.durationSec = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--ramp") {
+                options.ramp = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+            }
+            else if (arg == "--trickle-ms") {
+                options.trickleMs = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--reader-path") {
+                options.readerPath = argv[++i];
+            }
+            else if (arg == "--reader-bytes") {
+                options.readerBytes = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+            }
+            else if (arg == "--reader-ms") {
+                options.readerMs = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--probe-rate") {
+                options.probeRate = std::max(0.1, std::stod(argv[++i]));
+            }
+            else if (arg == "--probe-path") {
+                options.probePath = argv[++i];
+            }
+            else if (arg == "--pid") {
+                options.pid = static_cast<uint32_t>(std::stoul(argv[++i]));
+            }
+            else if (arg == "--source") {
+                options.sources.emplace_back(argv[++i]);
+            }
+            else if (arg == "--json") {
+                options.jsonFile = argv[++i];
+            }
+            else {
+                return false;
+            }
+        }
+        catch (const std::exception&) {   // std::stoi, std::stod.
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// as many open files as the hard limit allows, a slow connection is one.
+static void raise_open_files(uint64_t wanted) {
+#ifndef _WIN32
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < wanted) {
+        std::cerr << std::format("warning: {} open files at most, {} slow connections asked for.\n", limit.rlim_cur, wanted);
+    }
+#else
+    (void)wanted;
+#endif
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [--host <ip>] [--port <port>] [--idle <n>] [--trickle <n>] [--readers <n>] [--duration <sec>]\n"
+            << "       [--ramp <n>] [--trickle-ms <ms>] [--reader-path <path>] [--reader-bytes <n>] [--reader-ms <ms>]\n"
+            << "       [--probe-rate <n>] [--probe-path <path>] [--pid <server pid>] [--source <ip>]... [--json <file>]\n";
+        return -1;
+    }
+
+    sockaddr_in addr;
+    if (!net_startup(options.host, options.port, addr)) {
+        return -1;
+    }
+
+    uint64_t slowTotal = 0;
+    for (auto n : options.slow) {
+        slowTotal += n;
+    }
+    raise_open_files(slowTotal + 64);
+
+    SlowClients slow{ options, addr };
+    Probe probe;
+    std::atomic<bool> stop{ false };
+    auto start = Clock::now();
+    auto end = start + std::chrono::seconds{ options.durationSec };
+    std::thread probeThread{ [&] { probe.run(options, addr, start, stop); } };
+
+    ProcessSample peak;
+    auto nextReport = start + std::chrono::seconds{ 1 };
+    for (auto now = start; now < end; now = Clock::now()) {
+        slow.tick(now);
+
+        if (now >= nextReport) {
+            auto [latency, errors] = probe.take_interval();
+            auto server = ProcessSample::of(options.pid);
+            peak.valid |= server.valid;
+            peak.rssBytes = std::max(peak.rssBytes, server.rssBytes);
+            peak.threads = std::max(peak.threads, server.threads);
+            peak.handles = std::max(peak.handles, server.handles);
+
+            auto line = std::format("{:>5}s slow {:>6} opened {:>7} closed by server {:>7} | probe {:>4} p50 {:>8.1f}ms p99 {:>8.1f}ms max {:>8.1f}ms errors {}",
+                std::chrono::duration_cast<std::chrono::seconds>(now - start).count(), slow.open, slow.opened,
+                slow.serverCloses[SLOW_IDLE] + slow.serverCloses[SLOW_TRICKLE] + slow.serverCloses[SLOW_READER],
+                latency.count(), latency.quantile(0.5) / 1e6, latency.quantile(0.99) / 1e6, latency.max() / 1e6, errors);
+            if (server.valid) {
+                line += std::format(" | rss {:.1f}MiB threads {} handles {}", server.rssBytes / (1024.0 * 1024), server.threads, server.handles);
+            }
+            std::cout << line << std::endl;
+            nextReport += std::chrono::seconds{ 1 };
+        }
+
+        std::this_thread::sleep_until(now + std::chrono::milliseconds{ TICK_MS });
+    }
+
+    stop = true;
+    probeThread.join();
+    auto wallSec = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::string out = std::format("\nslow connections: peak open {}, opened {}, connect failures {}\n", slow.openPeak, slow.opened, slow.connectFailures);
+    for (uint8_t kind = 0; kind < SLOW_KINDS; ++kind) {
+        if (options.slow[kind] == 0) {
+            continue;
+        }
+        out += std::format("{} {}: closed by server {}, answered {}, ", SLOW_KIND_NAMES[kind], options.slow[kind], slow.serverCloses[kind], slow.answered[kind]);
+        append_quantiles_text(out, "lifetime when closed", slow.lifetimes[kind]);
+    }
+    out += std::format("probe: requests {}, errors {}\n", probe.requests, probe.errors);
+    append_quantiles_text(out, "probe latency from due time", probe.total);
+    if (peak.valid) {
+        out += std::format("server peak: rss {:.1f}MiB, threads {}, handles {}\n", peak.rssBytes / (1024.0 * 1024), peak.threads, peak.handles);
+    }
+    std::cout << out;
+
+    if (!options.jsonFile.empty()) {
+        auto json = std::format("{{\n  \"mode\": \"soak\",\n  \"duration_s\": {:.3f},\n  \"idle\": {},\n  \"trickle\": {},\n  \"readers\": {},\n"
+            "  \"slow_open_peak\": {},\n  \"slow_closed_by_server\": {},\n  \"connect_failures\": {},\n"
+            "  \"requests\": {},\n  \"errors\": {},\n  \"throughput_rps\": {:.3f},\n  \"peak_rss_bytes\": {},\n  \"peak_threads\": {},\n  \"peak_handles\": {},\n",
+            wallSec, options.slow[SLOW_IDLE], options.slow[SLOW_TRICKLE], options.slow[SLOW_READER],
+            slow.openPeak, slow.serverCloses[SLOW_IDLE] + slow.serverCloses[SLOW_TRICKLE] + slow.serverCloses[SLOW_READER], slow.connectFailures,
+            probe.requests, probe.errors, probe.requests / wallSec, peak.rssBytes, peak.threads, peak.handles);
+        append_quantiles_json(json, "latency_us", probe.total, true);
+        json += "}\n";
+
+        if (options.jsonFile == "-") {
+            std::cout << json;
+        }
+        else if (!(std::ofstream{ options.jsonFile } << json)) {
+            std::cerr << "error: cannot write " << options.jsonFile << "\n";
+            return -1;
+        }
+    }
+
+    return probe.errors == 0 ? 0 : 1;
+}
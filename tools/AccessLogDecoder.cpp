@@ -0,0 +1,231 @@
+/*
+    decodes the binary access log of HttpFileServer (--binary-log) into the text format of the server,
+    or into csv.
+
+    build: cl /std:c++20 /EHsc /O2 /I.. AccessLogDecoder.cpp ws2_32.lib
+           g++ -std=c++20 -O2 -I.. AccessLogDecoder.cpp -o AccessLogDecoder
+    usage: AccessLogDecoder [--csv] [--stats] <segment>...
+*/
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <format>
+#include <algorithm>
+#include <cstdint>
+
+#include "BinaryAccessLog.h"
+
+struct DecodeStats {
+    uint64_t segments = 0;
+    uint64_t records = 0;
+    uint64_t strings = 0;
+    uint64_t bytes = 0;
+    uint64_t textBytes = 0;   // what the same records take as text lines.
+};
+
+static void append_quoted(std::string& out, std::string_view str, bool csv) {
+    for (char c : str) {
+        if (csv) {
+            if (c == '"') {
+                out += '"';
+            }
+            out += c;
+        }
+        else if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f) {
+            out += std::format("\\x{:02x}", static_cast<unsigned char>(c));
+        }
+        else {
+            out += c;
+        }
+    }
+}
+
+static void format_time(std::string& out, int64_t timeUs) {
+    using namespace std::chrono;
+
+    sys_time<microseconds> time{ microseconds{ timeUs } };
+    auto days = floor<std::chrono::days>(time);
+    year_month_day ymd{ days };
+    hh_mm_ss hms{ time - days };
+
+    out += std::format("{:04}-{:02}-{:02}T{:02}:{:02}:{:02}.{:06}Z",
+        static_cast<int>(ymd.year()), static_cast<unsigned>(ymd.month()), static_cast<unsigned>(ymd.day()),
+        hms.hours().count(), hms.minutes().count(), hms.seconds().count(), hms.subseconds().count());
+}
+
+/*
+    decodes one segment, appends a line per record to <out>.
+    returns false if the segment is corrupted, the records before the corruption are kept.
+*/
+static bool decode_segment(const std::vector<uint8_t>& data, bool csv, std::string& out, DecodeStats& stats) {
+    if (data.size() < BINLOG_HEADER_LEN || !std::equal(BINLOG_MAGIC.begin(), BINLOG_MAGIC.end(), data.begin())) {
+        return false;
+    }
+
+    const uint8_t* pos = data.data() + BINLOG_HEADER_LEN;
+    const uint8_t* end = data.data() + data.size();
+    auto timeUs = static_cast<int64_t>(binlog_get_u64le(data.data() + BINLOG_MAGIC.size()));
+    std::vector<std::string_view> strings;
+
+    ++stats.segments;
+    stats.bytes += BINLOG_HEADER_LEN;
+
+    while (pos < end) {
+        auto entryBegin = pos;
+        auto kind = *pos++;
+
+        if (kind == BINLOG_ENTRY_END) {   // a segment that was not closed, the zero tail is not counted.
+            return true;
+        }
+        else if (kind == BINLOG_ENTRY_STRING) {
+            uint64_t id, len;
+            if (!binlog_get_varint(pos, end, id) || !binlog_get_varint(pos, end, len)
+                || id != strings.size() || len > static_cast<uint64_t>(end - pos)) {
+                return false;
+            }
+
+            strings.emplace_back(reinterpret_cast<const char*>(pos), static_cast<size_t>(len));
+            pos += len;
+            ++stats.strings;
+            stats.bytes += pos - entryBegin;
+        }
+        else if (kind == BINLOG_ENTRY_RECORD) {
+            uint64_t delta, durationUs, bytes, status, methodId, pathId, cpuUs, minorFaults, majorFaults, voluntarySwitches, family;
+            uint64_t rttUs, cwnd, retransmits, deliveryRate, busyUs, rwndLimitedUs;
+            if (!binlog_get_varint(pos, end, delta) || !binlog_get_varint(pos, end, durationUs)
+                || !binlog_get_varint(pos, end, bytes) || !binlog_get_varint(pos, end, status)
+                || !binlog_get_varint(pos, end, methodId) || !binlog_get_varint(pos, end, pathId)
+                || !binlog_get_varint(pos, end, cpuUs) || !binlog_get_varint(pos, end, minorFaults)
+                || !binlog_get_varint(pos, end, majorFaults) || !binlog_get_varint(pos, end, voluntarySwitches)
+                || !binlog_get_varint(pos, end, rttUs) || !binlog_get_varint(pos, end, cwnd)
+                || !binlog_get_varint(pos, end, retransmits) || !binlog_get_varint(pos, end, deliveryRate)
+                || !binlog_get_varint(pos, end, busyUs) || !binlog_get_varint(pos, end, rwndLimitedUs)
+                || !binlog_get_varint(pos, end, family)
+                || methodId >= strings.size() || pathId >= strings.size()) {
+                return false;
+            }
+
+            char client[INET6_ADDRSTRLEN] = "-";
+            size_t addrLen = family == BINLOG_CLIENT_IPV4 ? 4 : family == BINLOG_CLIENT_IPV6 ? 16 : 0;
+            if (addrLen > static_cast<size_t>(end - pos)) {
+                return false;
+            }
+
+            if (addrLen != 0) {
+                inet_ntop(family == BINLOG_CLIENT_IPV4 ? AF_INET : AF_INET6, pos, client, sizeof(client));
+                pos += addrLen;
+            }
+
+            timeUs += binlog_zigzag_decode(delta);
+            auto lineBegin = out.size();
+
+            if (csv) {
+                format_time(out, timeUs);
+                out += std::format(",{},{},\"", client, strings[methodId]);
+                append_quoted(out, strings[pathId], true);
+                out += std::format("\",{},{},{},{},{},{},{},{},{},{},{},{},{}\n", status, bytes, durationUs, cpuUs, minorFaults, majorFaults, voluntarySwitches,
+                    rttUs, cwnd, retransmits, deliveryRate, busyUs, rwndLimitedUs);
+            }
+            else {
+                out += "time=";
+                format_time(out, timeUs);
+                out += std::format(" client={} method={} path=\"", client, strings[methodId]);
+                append_quoted(out, strings[pathId], false);
+                out += std::format("\" status={} bytes={} duration_us={} cpu_us={} minflt={} majflt={} nvcsw={} rtt_us={} cwnd={} retrans={} delivery_rate={} busy_us={} rwnd_limited_us={}\n",
+                    status, bytes, durationUs, cpuUs, minorFaults, majorFaults, voluntarySwitches, rttUs, cwnd, retransmits, deliveryRate, busyUs, rwndLimitedUs);
+            }
+
+            ++stats.records;
+            stats.bytes += pos - entryBegin;
+            stats.textBytes += csv ? 0 : out.size() - lineBegin;
+        }
+        else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    bool csv = false;
+    bool printStats = false;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+
+        if (arg == "--csv") {
+            csv = true;
+        }
+        else if (arg == "--stats") {
+            printStats = true;
+        }
+        else {
+            files.emplace_back(arg);
+        }
+    }
+
+    if (files.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--csv] [--stats] <segment>...\n";
+        return -1;
+    }
+
+    // segments sort by name in the order they were written.
+    std::sort(files.begin(), files.end());
+
+    if (csv) {
+        std::cout << "time,client,method,path,status,bytes,duration_us,cpu_us,minflt,majflt,nvcsw,rtt_us,cwnd,retrans,delivery_rate,busy_us,rwnd_limited_us\n";
+    }
+
+    DecodeStats stats;
+    std::string out;
+    int ret = 0;
+
+    for (const auto& file : files) {
+        std::ifstream in{ file, std::ios::binary };
+        if (!in) {
+            std::cerr << "error: cannot open " << file << "\n";
+            ret = -1;
+            continue;
+        }
+
+        std::vector<uint8_t> data{ std::istreambuf_iterator<char>{ in }, std::istreambuf_iterator<char>{} };
+
+        out.clear();
+        if (!decode_segment(data, csv, out, stats)) {
+            std::cerr << "error: " << file << " is corrupted, decoded records before the corruption.\n";
+            ret = -1;
+        }
+
+        std::cout << out;
+    }
+
+    if (printStats && stats.records != 0) {
+        std::cerr << std::format("{} segments, {} records, {} strings, {} bytes, {:.1f} bytes/record",
+            stats.segments, stats.records, stats.strings, stats.bytes, static_cast<double>(stats.bytes) / stats.records);
+
+        if (!csv) {
+            std::cerr << std::format(", text {:.1f} bytes/record", static_cast<double>(stats.textBytes) / stats.records);
+        }
+        std::cerr << "\n";
+    }
+
+    return ret;
+}
@@ -0,0 +1,369 @@
+/*
+    builds a synthetic file tree for the benchmarks, from a profile and a seed, the same seed always gives the
+    same tree, on any platform: the random numbers come straight from mt19937_64, whose output the standard
+    fixes, not from the std distributions, whose output differs between standard libraries.
+
+    profiles:
+        cdn     hashed asset names in sharded directories, many small files.
+        build   build artifacts, deeply nested module directories, object files and a few big libraries.
+        media   a media library, artist/album/track, photos and videos, big files, many non-ASCII names.
+        flat    one directory with 100000 entries per --scale.
+        deep    chains of 64 nested directories, a couple of files on each level.
+    names mix plain ASCII, characters the server escapes ('#', '%', '&', spaces) and UTF-8 from several scripts.
+    files are sized with resize_file, sparse where the filesystem allows it, --size-scale shrinks them.
+
+    a manifest is written next to the tree (--manifest), in the mix format of bench/LoadGenerator.cpp:
+    "<class> <path>" lines, small and large files (split at 1 MiB), listing for every directory, missing for
+    paths that don't exist, after a comment line with the profile, the seed and the totals.
+
+    build: cl /std:c++20 /EHsc /O2 TreeGenerator.cpp
+           g++ -std=c++20 -O2 TreeGenerator.cpp -o TreeGenerator
+    usage: TreeGenerator --profile <cdn|build|media|flat|deep> [--seed <n>] [--scale <n>] [--size-scale <f>]
+                         [--manifest <file>] <output dir>
+*/
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <map>
+#include <set>
+#include <random>
+#include <format>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace fs = std::filesystem;
+
+constexpr uint64_t LARGE_FILE_MIN = 1024 * 1024;   // the small / large split of the manifest.
+constexpr size_t MISSING_PATHS_MAX = 1000;
+
+constexpr std::array<std::string_view, 20> ASCII_WORDS{
+    "alpha", "beta", "gamma", "delta", "report", "photo", "index", "main", "vendor", "app",
+    "util", "core", "data", "image", "track", "scene", "draft", "final", "backup", "notes"
+};
+
+// spelled in UTF-8 bytes, so the source encoding doesn't matter.
+constexpr std::array<std::string_view, 20> UNICODE_WORDS{
+    "\xe6\x96\x87\xe4\xbb\xb6",                                  // 文件
+    "\xe6\x8a\xa5\xe5\x91\x8a",                                  // 报告
+    "\xe7\x85\xa7\xe7\x89\x87",                                  // 照片
+    "\xe3\x83\x86\xe3\x82\xb9\xe3\x83\x88",                      // テスト
+    "\xe5\x86\x99\xe7\x9c\x9f",                                  // 写真
+    "\xe3\x83\x87\xe3\x83\xbc\xe3\x82\xbf",                      // データ
+    "\xd0\xb4\xd0\xbe\xd0\xba\xd1\x83\xd0\xbc\xd0\xb5\xd0\xbd\xd1\x82",   // документ
+    "\xd1\x84\xd0\xbe\xd1\x82\xd0\xbe",                          // фото
+    "\xce\xb1\xcf\x81\xcf\x87\xce\xb5\xce\xaf\xce\xbf",          // αρχείο
+    "\xcf\x83\xce\xb7\xce\xbc\xce\xb5\xce\xb9\xcf\x8e\xcf\x83\xce\xb5\xce\xb9\xcf\x82",   // σημειώσεις
+    "caf\xc3\xa9",                                               // café
+    "na\xc3\xafve",                                              // naïve
+    "r\xc3\xa9sum\xc3\xa9",                                      // résumé
+    "\xc3\x86r\xc3\xb8",                                         // Ærø
+    "sm\xc3\xb6rg\xc3\xa5sbord",                                 // smörgåsbord
+    "\xf0\x9f\x8e\xb5",                                          // 🎵
+    "\xf0\x9f\x93\xb7 trip",                                     // 📷 trip
+    "\xd9\x85\xd8\xb3\xd8\xaa\xd9\x86\xd8\xaf",                  // مستند
+    "\xed\x8c\x8c\xec\x9d\xbc",                                  // 파일
+    "\xec\x82\xac\xec\xa7\x84"                                   // 사진
+};
+
+// valid on windows too, none of <>:"/\|?*.
+constexpr std::array<std::string_view, 8> SPECIAL_WORDS{
+    "a b", "100% done", "#1 hit", "rock & roll", "it's", "[draft]", "{tmp}", "~old"
+};
+
+struct Options {
+    std::string profile;
+    uint64_t seed = 1;
+    uint64_t scale = 1;
+    double sizeScale = 1.0;
+    fs::path output;
+    fs::path manifest;
+};
+
+class TreeGenerator {
+    std::mt19937_64 rng;
+    double unicodeRatio = 0;
+    double sizeScale;
+    uint64_t nameCount = 0;
+
+    std::set<std::string> dirs;   // relative, '/' separated, without the trailing '/'.
+    std::vector<std::pair<std::string, uint64_t>> files;
+public:
+    TreeGenerator(uint64_t seed, double _sizeScale) : rng{ seed }, sizeScale{ _sizeScale } {}
+
+    uint64_t below(uint64_t n) {   // the bias of the modulo is far below what a benchmark could notice.
+        return n == 0 ? 0 : rng() % n;
+    }
+
+    double uniform() {   // [0, 1), 53 bits.
+        return static_cast<double>(rng() >> 11) * 0x1.0p-53;
+    }
+
+    bool chance(double p) {
+        return uniform() < p;
+    }
+
+    // a log-normal size around <median>, Box-Muller, capped at <max>.
+    uint64_t size_around(double median, double sigma, double max) {
+        auto u1 = std::max(uniform(), 0x1.0p-53);
+        auto normal = std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * 3.14159265358979323846 * uniform());
+        return static_cast<uint64_t>(std::min(median * std::exp(sigma * normal), max) * sizeScale);
+    }
+
+    std::string hex(size_t digits) {
+        auto value = rng();
+        std::string out;
+        for (size_t i = 0; i < digits; ++i) {
+            out += "0123456789abcdef"[(value >> (4 * (i % 16))) & 0xf];
+        }
+        return out;
+    }
+
+    void set_unicode_ratio(double ratio) {
+        unicodeRatio = ratio;
+    }
+
+    // a word that is plain, to escape, or non-ASCII, with a number that keeps it unique in the tree.
+    std::string name(std::string_view suffix = {}) {
+        std::string_view word;
+        if (chance(unicodeRatio)) {
+            word = UNICODE_WORDS[below(UNICODE_WORDS.size())];
+        }
+        else if (chance(0.05)) {
+            word = SPECIAL_WORDS[below(SPECIAL_WORDS.size())];
+        }
+        else {
+            word = ASCII_WORDS[below(ASCII_WORDS.size())];
+        }
+        return std::format("{}-{}{}", word, nameCount++, suffix);
+    }
+
+    std::string dir(const std::string& parent, const std::string& child) {
+        auto path = parent.empty() ? child : parent + "/" + child;
+        dirs.insert(path);
+        return path;
+    }
+
+    // sized here, after the name, a call never has two arguments drawing numbers in an unspecified order.
+    void file(const std::string& parent, const std::string& child, double median, double sigma, double max) {
+        files.emplace_back(parent.empty() ? child : parent + "/" + child, size_around(median, sigma, max));
+    }
+
+    const std::set<std::string>& all_dirs() const {
+        return dirs;
+    }
+
+    const std::vector<std::pair<std::string, uint64_t>>& all_files() const {
+        return files;
+    }
+};
+
+static void generate_cdn(TreeGenerator& g, uint64_t scale) {
+    struct Kind { std::string_view dir, ext; double median; };
+    constexpr std::array<Kind, 5> KINDS{ {
+        { "js", ".min.js", 30e3 }, { "css", ".css", 8e3 }, { "img", ".png", 20e3 }, { "img", ".svg", 3e3 }, { "fonts", ".woff2", 60e3 }
+    } };
+
+    g.set_unicode_ratio(0.02);
+    auto assets = g.dir("", "assets");
+    for (uint64_t i = 0; i < 20000 * scale; ++i) {
+        auto& kind = KINDS[g.below(KINDS.size())];
+        auto shard = g.dir(g.dir(assets, std::string{ kind.dir }), g.hex(2));   // like a content hash prefix.
+        g.file(shard, g.name("." + g.hex(8) + std::string{ kind.ext }), kind.median, 1.2, 8e6);
+    }
+}
+
+static void generate_build(TreeGenerator& g, uint64_t scale) {
+    g.set_unicode_ratio(0.01);
+    auto build = g.dir("", "build");
+
+    for (uint64_t m = 0; m < 50 * scale; ++m) {
+        auto module = g.dir(build, g.name());
+        auto dir = module;
+
+        for (uint64_t level = 0, depth = 3 + g.below(8); level < depth; ++level) {
+            dir = g.dir(dir, level == 0 ? "obj" : g.name());
+            for (uint64_t f = 0, count = g.below(40); f < count; ++f) {
+                auto base = g.name();
+                g.file(dir, base + ".o", 24e3, 1.5, 16e6);
+                g.file(dir, base + ".d", 1e3, 0.8, 64e3);
+            }
+        }
+
+        g.file(module, g.name(".a"), 4e6, 1.0, 256e6);
+        if (g.chance(0.2)) {
+            g.file(module, g.name(".so"), 8e6, 1.0, 256e6);
+        }
+        g.file(module, "build.log", 50e3, 1.0, 4e6);
+    }
+}
+
+static void generate_media(TreeGenerator& g, uint64_t scale) {
+    g.set_unicode_ratio(0.4);
+    auto music = g.dir("", "Music");
+    auto photos = g.dir("", "Photos");
+    auto videos = g.dir("", "Videos");
+
+    for (uint64_t a = 0; a < 100 * scale; ++a) {
+        auto artist = g.dir(music, g.name());
+        for (uint64_t b = 0, albums = 1 + g.below(6); b < albums; ++b) {
+            auto album = g.dir(artist, g.name(std::format(" ({})", 1970 + g.below(55))));
+            g.file(album, "cover.jpg", 500e3, 0.5, 8e6);
+            for (uint64_t t = 1, tracks = 8 + g.below(8); t <= tracks; ++t) {
+                g.file(album, std::format("{:02} - {}", t, g.name(".flac")), 25e6, 0.4, 200e6);
+            }
+        }
+    }
+
+    for (uint64_t p = 0; p < 1000 * scale; ++p) {
+        auto year = g.dir(photos, std::format("{}", 2010 + g.below(15)));
+        auto month = g.dir(year, std::format("{:02}", 1 + g.below(12)));
+        g.file(month, g.name(".jpg"), 3e6, 0.5, 40e6);
+    }
+
+    for (uint64_t v = 0; v < 20 * scale; ++v) {
+        g.file(videos, g.name(".mp4"), 300e6, 1.0, 4e9);
+    }
+}
+
+static void generate_flat(TreeGenerator& g, uint64_t scale) {
+    g.set_unicode_ratio(0.1);
+    auto flat = g.dir("", "flat");
+
+    for (uint64_t i = 0; i < 100000 * scale; ++i) {
+        g.file(flat, g.name(".txt"), 2e3, 1.0, 1e6);
+    }
+}
+
+static void generate_deep(TreeGenerator& g, uint64_t scale) {
+    g.set_unicode_ratio(0.1);
+
+    for (uint64_t c = 0; c < 100 * scale; ++c) {
+        auto dir = g.dir("", g.name());
+        for (uint64_t level = 0; level < 64; ++level) {
+            dir = g.dir(dir, g.name());
+            g.file(dir, g.name(".html"), 4e3, 1.0, 1e6);
+            g.file(dir, g.name(".css"), 2e3, 1.0, 1e6);
+        }
+    }
+}
+
+static const std::map<std::string_view, void (*)(TreeGenerator&, uint64_t)> PROFILES{
+    { "cdn", generate_cdn },
+    { "build", generate_build },
+    { "media", generate_media },
+    { "flat", generate_flat },
+    { "deep", generate_deep }
+};
+
+// a UTF-8 relative path to a path of the platform, windows paths are UTF-16.
+static fs::path native_path(const fs::path& root, const std::string& relative) {
+    return root / fs::path(std::u8string(relative.begin(), relative.end()));
+}
+
+static void write_tree(const TreeGenerator& g, const fs::path& root) {
+    fs::create_directories(root);
+    for (auto& dir : g.all_dirs()) {
+        fs::create_directories(native_path(root, dir));
+    }
+
+    for (auto& [file, size] : g.all_files()) {
+        auto path = native_path(root, file);
+        std::ofstream{ path, std::ios::binary };
+        fs::resize_file(path, size);
+    }
+}
+
+static void write_manifest(TreeGenerator& g, const Options& options) {
+    std::ofstream out{ options.manifest, std::ios::binary };
+    if (!out) {
+        throw std::runtime_error("cannot write " + options.manifest.string());
+    }
+
+    uint64_t bytes = 0;
+    for (auto& [file, size] : g.all_files()) {
+        bytes += size;
+    }
+
+    out << std::format("# profile={} seed={} scale={} size_scale={} dirs={} files={} bytes={}\n",
+        options.profile, options.seed, options.scale, options.sizeScale, g.all_dirs().size() + 1, g.all_files().size(), bytes);
+
+    out << "listing /\n";
+    for (auto& dir : g.all_dirs()) {
+        out << "listing /" << dir << "/\n";
+    }
+    for (auto& [file, size] : g.all_files()) {
+        out << (size < LARGE_FILE_MIN ? "small /" : "large /") << file << "\n";
+    }
+
+    // siblings of existing files, so a miss costs a lookup in a real directory.
+    auto& files = g.all_files();
+    for (size_t i = 0; i < std::min(MISSING_PATHS_MAX, files.size()); ++i) {
+        auto& file = files[g.below(files.size())].first;
+        out << "missing /" << file << ".missing\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--profile" && hasValue) {
+            options.profile = argv[++i];
+        }
+        else if (arg == "--seed" && hasValue) {
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--scale" && hasValue) {
+            options.scale = std::max<uint64_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--size-scale" && hasValue) {
+            options.sizeScale = std::max(0.0, std::atof(argv[++i]));
+        }
+        else if (arg == "--manifest" && hasValue) {
+            options.manifest = argv[++i];
+        }
+        else if (!arg.starts_with("--") && options.output.empty()) {
+            options.output = arg;
+        }
+        else {
+            options.output.clear();
+            break;
+        }
+    }
+
+    auto profile = PROFILES.find(options.profile);
+    if (options.output.empty() || profile == PROFILES.end()) {
+        std::cerr << "Usage: " << argv[0] << " --profile <cdn|build|media|flat|deep> [--seed <n>] [--scale <n>] [--size-scale <f>]"
+            " [--manifest <file>] <output dir>\n";
+        return -1;
+    }
+
+    if (options.manifest.empty()) {
+        options.manifest = options.output;
+        options.manifest += ".manifest";
+    }
+
+    try {
+        TreeGenerator generator{ options.seed, options.sizeScale };
+        profile->second(generator, options.scale);
+        write_tree(generator, options.output);
+        write_manifest(generator, options);
+
+        std::cerr << std::format("{}: {} directories, {} files, manifest {}\n",
+            options.output.string(), generator.all_dirs().size() + 1, generator.all_files().size(), options.manifest.string());
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+
+    return 0;
+}